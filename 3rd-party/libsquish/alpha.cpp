@@ -25,6 +25,7 @@
    
 #include "alpha.h"
 #include <algorithm>
+#include <climits>
 
 namespace squish {
 
@@ -70,6 +71,11 @@ void CompressAlphaDxt3( u8 const* rgba, int mask, void* block )
 }
 
 void DecompressAlphaDxt3( u8* rgba, void const* block )
+{
+	DecompressAlphaDxt3( rgba, 16, block );
+}
+
+void DecompressAlphaDxt3( u8* rgba, int stride, void const* block )
 {
 	u8 const* bytes = reinterpret_cast< u8 const* >( block );
 	
@@ -84,8 +90,9 @@ void DecompressAlphaDxt3( u8* rgba, void const* block )
 		u8 hi = quant & 0xf0;
 
 		// convert back up to bytes
-		rgba[8*i + 3] = lo | ( lo << 4 );
-		rgba[8*i + 7] = hi | ( hi >> 4 );
+		u8* pixel = rgba + ( i/2 )*stride + 8*( i % 2 );
+		pixel[3] = lo | ( lo << 4 );
+		pixel[7] = hi | ( hi >> 4 );
 	}
 }
 
@@ -293,6 +300,11 @@ void CompressAlphaDxt5( u8 const* rgba, int mask, void* block )
 }
 
 void DecompressAlphaDxt5( u8* rgba, void const* block )
+{
+	DecompressAlphaDxt5( rgba, 16, block );
+}
+
+void DecompressAlphaDxt5( u8* rgba, int stride, void const* block )
 {
 	// get the two alpha values
 	u8 const* bytes = reinterpret_cast< u8 const* >( block );
@@ -342,7 +354,7 @@ void DecompressAlphaDxt5( u8* rgba, void const* block )
 	
 	// write out the indexed codebook values
 	for( int i = 0; i < 16; ++i )
-		rgba[4*i + 3] = codes[indices[i]];
+		rgba[( i/4 )*stride + 4*( i % 4 ) + 3] = codes[indices[i]];
 }
 
 } // namespace squish
@@ -36,6 +36,9 @@ void CompressAlphaDxt5( u8 const* rgba, int mask, void* block );
 void DecompressAlphaDxt3( u8* rgba, void const* block );
 void DecompressAlphaDxt5( u8* rgba, void const* block );
 
+void DecompressAlphaDxt3( u8* rgba, int stride, void const* block );
+void DecompressAlphaDxt5( u8* rgba, int stride, void const* block );
+
 } // namespace squish
 
 #endif // ndef SQUISH_ALPHA_H
@@ -28,10 +28,11 @@
 #include "colourset.h"
 #include "colourblock.h"
 #include <cfloat>
+#include <cstring>
 
 namespace squish {
 
-ClusterFit::ClusterFit( ColourSet const* colours, int flags ) 
+ClusterFit::ClusterFit( ColourSet const* colours, int flags, float targetError ) 
   : ColourFit( colours, flags )
 {
 	// set the iteration count
@@ -56,6 +57,58 @@ ClusterFit::ClusterFit( ColourSet const* colours, int flags )
 	
 	// compute the principle component
 	m_principle = ComputePrincipleComponent( covariance );
+
+	// the fit errors leave out the constant weighted sum of the squared points, so take it off the target
+	m_targeterror = VEC4_CONST( -FLT_MAX );
+	if( targetError > 0.0f )
+	{
+		float const* weights = m_colours->GetWeights();
+		Vec3 xxsum( 0.0f );
+		float wsum = 0.0f;
+		for( int i = 0; i < count; ++i )
+		{
+			xxsum += weights[i]*values[i]*values[i];
+			wsum += weights[i];
+		}
+		Vec3 metric = m_metric.GetVec3();
+		float target = targetError*wsum/( 255.0f*255.0f ) - Dot( metric, xxsum );
+		m_targeterror = Vec4( target );
+		m_hasTargetError = true;
+	}
+}
+
+bool ClusterFit::IsTargetErrorMet() const
+{
+	return CompareAnyLessThan( m_besterror, m_targeterror );
+}
+
+static void SortExchange( std::uint64_t* keys, int a, int b )
+{
+	std::uint64_t lo = ( keys[a] < keys[b] ) ? keys[a] : keys[b];
+	std::uint64_t hi = ( keys[a] < keys[b] ) ? keys[b] : keys[a];
+	keys[a] = lo;
+	keys[b] = hi;
+}
+
+// 60 comparator, 10 layer sorting network for 16 inputs
+static void SortNetwork16( std::uint64_t* keys )
+{
+	static u8 const pairs[60][2] = 
+	{
+		{ 0, 13 }, { 1, 12 }, { 2, 15 }, { 3, 14 }, { 4, 8 }, { 5, 6 }, { 7, 11 }, { 9, 10 },
+		{ 0, 5 }, { 1, 7 }, { 2, 9 }, { 3, 4 }, { 6, 13 }, { 8, 14 }, { 10, 15 }, { 11, 12 },
+		{ 0, 1 }, { 2, 3 }, { 4, 5 }, { 6, 8 }, { 7, 9 }, { 10, 11 }, { 12, 13 }, { 14, 15 },
+		{ 0, 2 }, { 1, 3 }, { 4, 10 }, { 5, 11 }, { 6, 7 }, { 8, 9 }, { 12, 14 }, { 13, 15 },
+		{ 1, 2 }, { 3, 12 }, { 4, 6 }, { 5, 7 }, { 8, 10 }, { 9, 11 }, { 13, 14 },
+		{ 1, 4 }, { 2, 6 }, { 5, 8 }, { 7, 10 }, { 9, 13 }, { 11, 14 },
+		{ 2, 4 }, { 3, 6 }, { 9, 12 }, { 11, 13 },
+		{ 3, 5 }, { 6, 8 }, { 7, 9 }, { 10, 12 },
+		{ 3, 4 }, { 5, 6 }, { 7, 8 }, { 9, 10 }, { 11, 12 },
+		{ 6, 7 }, { 8, 9 }
+	};
+
+	for( int i = 0; i < 60; ++i )
+		SortExchange( keys, pairs[i][0], pairs[i][1] );
 }
 
 bool ClusterFit::ConstructOrdering( Vec3 const& axis, int iteration )
@@ -64,39 +117,38 @@ bool ClusterFit::ConstructOrdering( Vec3 const& axis, int iteration )
 	int const count = m_colours->GetCount();
 	Vec3 const* values = m_colours->GetPoints();
 
-	// build the list of dot products
-	float dps[16];
-	u8* order = ( u8* )m_order + 16*iteration;
+	// build sort keys from the dot products, mapping the float bits so that unsigned order matches
+	// float order and putting the point index in the low bits to keep equal values in index order
+	std::uint64_t keys[16];
 	for( int i = 0; i < count; ++i )
 	{
-		dps[i] = Dot( values[i], axis );
-		order[i] = ( u8 )i;
+		// adding zero turns -0 into +0 so they compare equal
+		float dp = Dot( values[i], axis ) + 0.0f;
+		std::uint32_t bits;
+		std::memcpy( &bits, &dp, sizeof( bits ) );
+		bits = ( bits & 0x80000000u ) ? ~bits : ( bits | 0x80000000u );
+		keys[i] = ( ( std::uint64_t )bits << 4 ) | ( std::uint64_t )i;
 	}
-		
+	for( int i = count; i < 16; ++i )
+		keys[i] = ~( std::uint64_t )0;
+
 	// stable sort using them
+	SortNetwork16( keys );
+
+	// the indices packed into nibbles identify the ordering exactly
+	u8* order = ( u8* )m_order + 16*iteration;
+	std::uint64_t orderKey = 0;
 	for( int i = 0; i < count; ++i )
 	{
-		for( int j = i; j > 0 && dps[j] < dps[j - 1]; --j )
-		{
-			std::swap( dps[j], dps[j - 1] );
-			std::swap( order[j], order[j - 1] );
-		}
+		order[i] = ( u8 )( keys[i] & 0xf );
+		orderKey |= ( keys[i] & 0xf ) << ( 4*i );
 	}
+	m_orderKey[iteration] = orderKey;
 	
 	// check this ordering is unique
 	for( int it = 0; it < iteration; ++it )
 	{
-		u8 const* prev = ( u8* )m_order + 16*it;
-		bool same = true;
-		for( int i = 0; i < count; ++i )
-		{
-			if( order[i] != prev[i] )
-			{
-				same = false;
-				break;
-			}
-		}
-		if( same )
+		if( m_orderKey[it] == orderKey )
 			return false;
 	}
 	
@@ -206,8 +258,8 @@ void ClusterFit::Compress3( void* block )
 			part0 += m_points_weights[i];
 		}
 		
-		// stop if we didn't improve in this iteration
-		if( bestiteration != iterationIndex )
+		// stop if we didn't improve in this iteration or the error is good enough
+		if( bestiteration != iterationIndex || CompareAnyLessThan( besterror, m_targeterror ) )
 			break;
 			
 		// advance if possible
@@ -349,8 +401,8 @@ void ClusterFit::Compress4( void* block )
 			part0 += m_points_weights[i];
 		}
 		
-		// stop if we didn't improve in this iteration
-		if( bestiteration != iterationIndex )
+		// stop if we didn't improve in this iteration or the error is good enough
+		if( bestiteration != iterationIndex || CompareAnyLessThan( besterror, m_targeterror ) )
 			break;
 			
 		// advance if possible
@@ -31,29 +31,33 @@
 #include "maths.h"
 #include "simd.h"
 #include "colourfit.h"
+#include <cstdint>
 
 namespace squish {
 
 class ClusterFit : public ColourFit
 {
 public:
-	ClusterFit( ColourSet const* colours, int flags );
+	ClusterFit( ColourSet const* colours, int flags, float targetError = 0.0f );
 	
 private:
 	bool ConstructOrdering( Vec3 const& axis, int iteration );
 
 	virtual void Compress3( void* block );
 	virtual void Compress4( void* block );
+	virtual bool IsTargetErrorMet() const;
 
 	enum { kMaxIterations = 8 };
 
 	int m_iterationCount;
 	Vec3 m_principle;
 	u8 m_order[16*kMaxIterations];
+	std::uint64_t m_orderKey[kMaxIterations];
 	Vec4 m_points_weights[16];
 	Vec4 m_xsum_wsum;
 	Vec4 m_metric;
 	Vec4 m_besterror;
+	Vec4 m_targeterror;
 };
 
 } // namespace squish
@@ -24,6 +24,7 @@
    -------------------------------------------------------------------------- */
    
 #include "colourblock.h"
+#include <cstring>
 
 namespace squish {
 
@@ -158,6 +159,11 @@ static int Unpack565( u8 const* packed, u8* colour )
 }
 
 void DecompressColour( u8* rgba, void const* block, bool isDxt1 )
+{
+	DecompressColour( rgba, 16, block, isDxt1 );
+}
+
+void DecompressColour( u8* rgba, int stride, void const* block, bool isDxt1 )
 {
 	// get the block bytes
 	u8 const* bytes = reinterpret_cast< u8 const* >( block );
@@ -199,25 +205,16 @@ void DecompressColour( u8* rgba, void const* block, bool isDxt1 )
 	codes[8 + 3] = 255;
 	codes[12 + 3] = ( isDxt1 && a <= b ) ? 0 : 255;
 	
-	// unpack the indices
-	u8 indices[16];
-	for( int i = 0; i < 4; ++i )
+	// store out the colours a row at a time, each row has one byte of indices
+	for( int y = 0; y < 4; ++y )
 	{
-		u8* ind = indices + 4*i;
-		u8 packed = bytes[4 + i];
+		u8 packed = bytes[4 + y];
+		u8* row = rgba + y*stride;
 		
-		ind[0] = packed & 0x3;
-		ind[1] = ( packed >> 2 ) & 0x3;
-		ind[2] = ( packed >> 4 ) & 0x3;
-		ind[3] = ( packed >> 6 ) & 0x3;
-	}
-
-	// store out the colours
-	for( int i = 0; i < 16; ++i )
-	{
-		u8 offset = 4*indices[i];
-		for( int j = 0; j < 4; ++j )
-			rgba[4*i + j] = codes[offset + j];
+		std::memcpy( row, codes + 4*( packed & 0x3 ), 4 );
+		std::memcpy( row + 4, codes + 4*( ( packed >> 2 ) & 0x3 ), 4 );
+		std::memcpy( row + 8, codes + 4*( ( packed >> 4 ) & 0x3 ), 4 );
+		std::memcpy( row + 12, codes + 4*( ( packed >> 6 ) & 0x3 ), 4 );
 	}
 }
 
@@ -35,6 +35,7 @@ void WriteColourBlock3( Vec3::Arg start, Vec3::Arg end, u8 const* indices, void*
 void WriteColourBlock4( Vec3::Arg start, Vec3::Arg end, u8 const* indices, void* block );
 
 void DecompressColour( u8* rgba, void const* block, bool isDxt1 );
+void DecompressColour( u8* rgba, int stride, void const* block, bool isDxt1 );
 
 } // namespace squish
 
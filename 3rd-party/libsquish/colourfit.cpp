@@ -30,7 +30,8 @@ namespace squish {
 
 ColourFit::ColourFit( ColourSet const* colours, int flags ) 
   : m_colours( colours ), 
-	m_flags( flags )
+	m_flags( flags ),
+	m_hasTargetError( false )
 {
 }
 
@@ -39,9 +40,19 @@ void ColourFit::Compress( void* block )
 	bool isDxt1 = ( ( m_flags & kDxt1 ) != 0 );
 	if( isDxt1 )
 	{
-		Compress3( block );
-		if( !m_colours->IsTransparent() )
+		if( m_hasTargetError && !m_colours->IsTransparent() )
+		{
+			// the 3 colour mode is only worth trying if 4 colours are not good enough
 			Compress4( block );
+			if( !IsTargetErrorMet() )
+				Compress3( block );
+		}
+		else
+		{
+			Compress3( block );
+			if( !m_colours->IsTransparent() )
+				Compress4( block );
+		}
 	}
 	else
 		Compress4( block );
@@ -43,9 +43,13 @@ public:
 protected:
 	virtual void Compress3( void* block ) = 0;
 	virtual void Compress4( void* block ) = 0;
+	
+	//! Returns true when the best fit so far is below the target error.
+	virtual bool IsTargetErrorMet() const { return false; }
 
 	ColourSet const* m_colours;
 	int m_flags;
+	bool m_hasTargetError;
 };
 
 } // namespace squish
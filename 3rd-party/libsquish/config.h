@@ -32,9 +32,27 @@
 #endif
 
 // Set to 1 or 2 when building squish to use SSE or SSE2 instructions.
+// When not set, SSE2 is used if the compiler targets it (always the case for x64).
 #ifndef SQUISH_USE_SSE
+#if defined( _M_X64 ) || defined( __SSE2__ ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#define SQUISH_USE_SSE 2
+#else
 #define SQUISH_USE_SSE 0
 #endif
+#endif
+
+// The SSE backend uses SSE4.1 rounding and FMA3 multiply-adds when the compiler targets them.
+// MSVC only reports /arch:AVX2, which implies both.
+#if SQUISH_USE_SSE > 1 && ( defined( __SSE4_1__ ) || defined( __AVX2__ ) )
+#define SQUISH_USE_SSE41 1
+#else
+#define SQUISH_USE_SSE41 0
+#endif
+#if SQUISH_USE_SSE > 1 && ( defined( __FMA__ ) || defined( __AVX2__ ) )
+#define SQUISH_USE_FMA 1
+#else
+#define SQUISH_USE_FMA 0
+#endif
 
 // Internally et SQUISH_USE_SIMD when either Altivec or SSE is available.
 #if SQUISH_USE_ALTIVEC && SQUISH_USE_SSE
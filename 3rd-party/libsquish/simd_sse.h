@@ -30,6 +30,12 @@
 #if ( SQUISH_USE_SSE > 1 )
 #include <emmintrin.h>
 #endif
+#if SQUISH_USE_SSE41
+#include <smmintrin.h>
+#endif
+#if SQUISH_USE_FMA
+#include <immintrin.h>
+#endif
 
 #define SQUISH_SSE_SPLAT( a )										\
 	( ( a ) | ( ( a ) << 2 ) | ( ( a ) << 4 ) | ( ( a ) << 6 ) )
@@ -114,13 +120,21 @@ public:
 	//! Returns a*b + c
 	friend Vec4 MultiplyAdd( Vec4::Arg a, Vec4::Arg b, Vec4::Arg c )
 	{
+#if SQUISH_USE_FMA
+		return Vec4( _mm_fmadd_ps( a.m_v, b.m_v, c.m_v ) );
+#else
 		return Vec4( _mm_add_ps( _mm_mul_ps( a.m_v, b.m_v ), c.m_v ) );
+#endif
 	}
 	
 	//! Returns -( a*b - c )
 	friend Vec4 NegativeMultiplySubtract( Vec4::Arg a, Vec4::Arg b, Vec4::Arg c )
 	{
+#if SQUISH_USE_FMA
+		return Vec4( _mm_fnmadd_ps( a.m_v, b.m_v, c.m_v ) );
+#else
 		return Vec4( _mm_sub_ps( c.m_v, _mm_mul_ps( a.m_v, b.m_v ) ) );
+#endif
 	}
 	
 	friend Vec4 Reciprocal( Vec4::Arg v )
@@ -158,6 +172,9 @@ public:
 		// clear out the MMX multimedia state to allow FP calls later
 		_mm_empty(); 
 		return Vec4( truncated );
+#elif SQUISH_USE_SSE41
+		// round towards zero without the round trip through integers
+		return Vec4( _mm_round_ps( v.m_v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC ) );
 #else
 		// use SSE2 instructions
 		return Vec4( _mm_cvtepi32_ps( _mm_cvttps_epi32( v.m_v ) ) );
@@ -31,6 +31,9 @@
 #include "colourblock.h"
 #include "alpha.h"
 #include "singlecolourfit.h"
+#include <atomic>
+#include <thread>
+#include <vector>
 
 namespace squish {
 
@@ -45,7 +48,7 @@ static int FixFlags( int flags )
 	// set defaults
 	if( method != kDxt3 && method != kDxt5 )
 		method = kDxt1;
-	if( fit != kColourRangeFit )
+	if( fit != kColourRangeFit && fit != kColourIterativeClusterFit )
 		fit = kColourClusterFit;
 	if( metric != kColourMetricUniform )
 		metric = kColourMetricPerceptual;
@@ -60,7 +63,7 @@ void Compress( u8 const* rgba, void* block, int flags )
 	CompressMasked( rgba, 0xffff, block, flags );
 }
 
-void CompressMasked( u8 const* rgba, int mask, void* block, int flags )
+void CompressMasked( u8 const* rgba, int mask, void* block, int flags, float targetError )
 {
 	// fix any bad flags
 	flags = FixFlags( flags );
@@ -90,7 +93,7 @@ void CompressMasked( u8 const* rgba, int mask, void* block, int flags )
 	else
 	{
 		// default to a cluster fit (could be iterative or not)
-		ClusterFit fit( &colours, flags );
+		ClusterFit fit( &colours, flags, targetError );
 		fit.Compress( colourBlock );
 	}
 	
@@ -133,77 +136,178 @@ int GetStorageRequirements( int width, int height, int flags )
 	return blockcount*blocksize;	
 }
 
-void CompressImage( u8 const* rgba, int width, int height, void* blocks, int flags )
+static void CompressImageRow( u8 const* rgba, int width, int height, int y, u8* targetBlock, int flags, float targetError )
 {
-	// fix any bad flags
-	flags = FixFlags( flags );
-
-	// initialise the block output
-	u8* targetBlock = reinterpret_cast< u8* >( blocks );
 	int bytesPerBlock = ( ( flags & kDxt1 ) != 0 ) ? 8 : 16;
 
-	// loop over blocks
-	for( int y = 0; y < height; y += 4 )
+	// loop over the blocks in the row
+	for( int x = 0; x < width; x += 4 )
 	{
-		for( int x = 0; x < width; x += 4 )
+		// build the 4x4 block of pixels
+		u8 sourceRgba[16*4];
+		u8* targetPixel = sourceRgba;
+		int mask = 0;
+		for( int py = 0; py < 4; ++py )
 		{
-			// build the 4x4 block of pixels
-			u8 sourceRgba[16*4];
-			u8* targetPixel = sourceRgba;
-			int mask = 0;
-			for( int py = 0; py < 4; ++py )
+			for( int px = 0; px < 4; ++px )
 			{
-				for( int px = 0; px < 4; ++px )
+				// get the source pixel in the image
+				int sx = x + px;
+				int sy = y + py;
+				
+				// enable if we're in the image
+				if( sx < width && sy < height )
 				{
-					// get the source pixel in the image
-					int sx = x + px;
-					int sy = y + py;
-					
-					// enable if we're in the image
-					if( sx < width && sy < height )
-					{
-						// copy the rgba value
-						u8 const* sourcePixel = rgba + 4*( width*sy + sx );
-						for( int i = 0; i < 4; ++i )
-							*targetPixel++ = *sourcePixel++;
-							
-						// enable this pixel
-						mask |= ( 1 << ( 4*py + px ) );
-					}
-					else
-					{
-						// skip this pixel as its outside the image
-						targetPixel += 4;
-					}
+					// copy the rgba value
+					u8 const* sourcePixel = rgba + 4*( width*sy + sx );
+					for( int i = 0; i < 4; ++i )
+						*targetPixel++ = *sourcePixel++;
+						
+					// enable this pixel
+					mask |= ( 1 << ( 4*py + px ) );
+				}
+				else
+				{
+					// skip this pixel as its outside the image
+					targetPixel += 4;
 				}
 			}
-			
-			// compress it into the output
-			CompressMasked( sourceRgba, mask, targetBlock, flags );
-			
-			// advance
-			targetBlock += bytesPerBlock;
 		}
+		
+		// compress it into the output
+		CompressMasked( sourceRgba, mask, targetBlock, flags, targetError );
+		
+		// advance
+		targetBlock += bytesPerBlock;
 	}
 }
 
-void DecompressImage( u8* rgba, int width, int height, void const* blocks, int flags )
+// Images with fewer blocks per thread than this are not worth splitting.
+static const int kMinCompressBlocksPerThread = 256;
+static const int kMinDecompressBlocksPerThread = 4096;
+
+static int GetBlockRowThreadCount( int width, int height, int threadCount, int minBlocksPerThread )
+{
+	int rowCount = ( height + 3 )/4;
+	int blockCount = rowCount*( ( width + 3 )/4 );
+
+	if( threadCount <= 0 )
+		threadCount = static_cast< int >( std::thread::hardware_concurrency() );
+	if( threadCount > blockCount/minBlocksPerThread )
+		threadCount = blockCount/minBlocksPerThread;
+	if( threadCount > rowCount )
+		threadCount = rowCount;
+
+	return threadCount > 1 ? threadCount : 1;
+}
+
+// Calls the function for every block row. Each thread takes the next unclaimed row until none are 
+// left, so threads that finish early keep working.
+template< typename RowFunction >
+static void ForEachBlockRow( int rowCount, int threadCount, RowFunction const& function )
+{
+	if( threadCount <= 1 )
+	{
+		for( int row = 0; row < rowCount; ++row )
+			function( row );
+		return;
+	}
+
+	std::atomic< int > nextRow( 0 );
+
+	auto worker = [&]()
+	{
+		for( ;; )
+		{
+			int row = nextRow.fetch_add( 1 );
+			if( row >= rowCount )
+				break;
+
+			function( row );
+		}
+	};
+
+	std::vector< std::thread > threads;
+	try
+	{
+		threads.reserve( threadCount - 1 );
+		for( int i = 1; i < threadCount; ++i )
+			threads.push_back( std::thread( worker ) );
+	}
+	catch( ... )
+	{
+		// the rows are shared out dynamically, so the threads that did start finish the image
+	}
+
+	worker();
+
+	for( std::size_t i = 0; i < threads.size(); ++i )
+		threads[i].join();
+}
+
+static void CompressImageRows( u8 const* rgba, int width, int height, void* blocks, int flags, float targetError, int threadCount )
 {
 	// fix any bad flags
 	flags = FixFlags( flags );
 
-	// initialise the block input
-	u8 const* sourceBlock = reinterpret_cast< u8 const* >( blocks );
+	// the blocks are written directly to their final offsets
+	u8* targetBlocks = reinterpret_cast< u8* >( blocks );
+	int bytesPerRow = ( ( width + 3 )/4 )*( ( ( flags & kDxt1 ) != 0 ) ? 8 : 16 );
+
+	ForEachBlockRow( ( height + 3 )/4, threadCount, [&]( int row )
+	{
+		CompressImageRow( rgba, width, height, row*4, targetBlocks + row*bytesPerRow, flags, targetError );
+	} );
+}
+
+void CompressImage( u8 const* rgba, int width, int height, void* blocks, int flags, float targetError )
+{
+	CompressImageRows( rgba, width, height, blocks, flags, targetError, 1 );
+}
+
+void CompressImageParallel( u8 const* rgba, int width, int height, void* blocks, int flags, float targetError, int threadCount )
+{
+	threadCount = GetBlockRowThreadCount( width, height, threadCount, kMinCompressBlocksPerThread );
+
+	CompressImageRows( rgba, width, height, blocks, flags, targetError, threadCount );
+}
+
+static void DecompressBlock( u8* rgba, int stride, void const* block, int flags )
+{
+	// get the block locations
+	void const* colourBlock = block;
+	void const* alphaBock = block;
+	if( ( flags & ( kDxt3 | kDxt5 ) ) != 0 )
+		colourBlock = reinterpret_cast< u8 const* >( block ) + 8;
+
+	// decompress colour
+	DecompressColour( rgba, stride, colourBlock, ( flags & kDxt1 ) != 0 );
+
+	// decompress alpha separately if necessary
+	if( ( flags & kDxt3 ) != 0 )
+		DecompressAlphaDxt3( rgba, stride, alphaBock );
+	else if( ( flags & kDxt5 ) != 0 )
+		DecompressAlphaDxt5( rgba, stride, alphaBock );
+}
+
+static void DecompressImageRow( u8* rgba, int width, int height, int y, u8 const* sourceBlock, int flags )
+{
 	int bytesPerBlock = ( ( flags & kDxt1 ) != 0 ) ? 8 : 16;
+	bool interiorRow = ( y + 4 ) <= height;
 
-	// loop over blocks
-	for( int y = 0; y < height; y += 4 )
+	// loop over the blocks in the row
+	for( int x = 0; x < width; x += 4 )
 	{
-		for( int x = 0; x < width; x += 4 )
+		if( interiorRow && ( x + 4 ) <= width )
+		{
+			// the whole block is inside the image, so decompress it in place
+			DecompressBlock( rgba + 4*( width*y + x ), 4*width, sourceBlock, flags );
+		}
+		else
 		{
 			// decompress the block
 			u8 targetRgba[4*16];
-			Decompress( targetRgba, sourceBlock, flags );
+			DecompressBlock( targetRgba, 16, sourceBlock, flags );
 			
 			// write the decompressed pixels to the correct image locations
 			u8 const* sourcePixel = targetRgba;
@@ -229,11 +333,38 @@ void DecompressImage( u8* rgba, int width, int height, void const* blocks, int f
 					}
 				}
 			}
-			
-			// advance
-			sourceBlock += bytesPerBlock;
 		}
+		
+		// advance
+		sourceBlock += bytesPerBlock;
 	}
 }
 
+static void DecompressImageRows( u8* rgba, int width, int height, void const* blocks, int flags, int threadCount )
+{
+	// fix any bad flags
+	flags = FixFlags( flags );
+
+	// initialise the block input
+	u8 const* sourceBlocks = reinterpret_cast< u8 const* >( blocks );
+	int bytesPerRow = ( ( width + 3 )/4 )*( ( ( flags & kDxt1 ) != 0 ) ? 8 : 16 );
+
+	ForEachBlockRow( ( height + 3 )/4, threadCount, [&]( int row )
+	{
+		DecompressImageRow( rgba, width, height, row*4, sourceBlocks + row*bytesPerRow, flags );
+	} );
+}
+
+void DecompressImage( u8* rgba, int width, int height, void const* blocks, int flags )
+{
+	DecompressImageRows( rgba, width, height, blocks, flags, 1 );
+}
+
+void DecompressImageParallel( u8* rgba, int width, int height, void const* blocks, int flags, int threadCount )
+{
+	threadCount = GetBlockRowThreadCount( width, height, threadCount, kMinDecompressBlocksPerThread );
+
+	DecompressImageRows( rgba, width, height, blocks, flags, threadCount );
+}
+
 } // namespace squish
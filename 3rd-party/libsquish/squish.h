@@ -107,6 +107,7 @@ void  Compress( u8 const* rgba, void* block, int flags );
 	@param mask		The valid pixel mask.
 	@param block	Storage for the compressed DXT block.
 	@param flags	Compression flags.
+	@param targetError	The colour error that is good enough, or 0 to disable.
 	
 	The source pixels should be presented as a contiguous array of 16 rgba
 	values, with each component as 1 byte each. In memory this should be:
@@ -137,8 +138,14 @@ void  Compress( u8 const* rgba, void* block, int flags );
 	weight the colour of each pixel by its alpha value. For images that are
 	rendered using alpha blending, this can significantly increase the 
 	perceived quality.
+	
+	The targetError parameter is the mean squared colour error per pixel, in 
+	0-255 units and weighted by the colour metric, below which the cluster fit 
+	stops searching. The iterative cluster fit stops iterating once it is met, 
+	and DXT1 blocks without transparency only try the 3 colour mode when the 
+	4 colour mode misses it. A value of 0 always runs the full search.
 */
-void CompressMasked( u8 const* rgba, int mask, void* block, int flags );
+void CompressMasked( u8 const* rgba, int mask, void* block, int flags, float targetError = 0.0f );
 
 // -----------------------------------------------------------------------------
 
@@ -186,6 +193,7 @@ int GetStorageRequirements( int width, int height, int flags );
 	@param height	The height of the source image.
 	@param blocks	Storage for the compressed output.
 	@param flags	Compression flags.
+	@param targetError	The colour error that is good enough, or 0 to disable.
 	
 	The source pixels should be presented as a contiguous array of width*height
 	rgba values, with each component as 1 byte each. In memory this should be:
@@ -210,11 +218,29 @@ int GetStorageRequirements( int width, int height, int flags );
 	rendered using alpha blending, this can significantly increase the 
 	perceived quality.
 	
-	Internally this function calls squish::Compress for each block. To see how
-	much memory is required in the compressed image, use
-	squish::GetStorageRequirements.
+	Internally this function calls squish::CompressMasked for each block, see 
+	it for the meaning of targetError. To see how much memory is required in 
+	the compressed image, use squish::GetStorageRequirements.
+*/
+void  CompressImage(u8 const* rgba, int width, int height, void* blocks, int flags, float targetError = 0.0f );
+
+// -----------------------------------------------------------------------------
+
+/*! @brief Compresses an image in memory using multiple threads.
+
+	@param rgba			The pixels of the source.
+	@param width		The width of the source image.
+	@param height		The height of the source image.
+	@param blocks		Storage for the compressed output.
+	@param flags		Compression flags.
+	@param targetError	The colour error that is good enough, or 0 to disable.
+	@param threadCount	The maximum number of threads, or 0 for one per core.
+	
+	The output is identical to squish::CompressImage. The rows of blocks are 
+	handed out to the calling thread and threadCount - 1 worker threads as each 
+	finishes its previous row. Small images are compressed on the calling thread.
 */
-void  CompressImage(u8 const* rgba, int width, int height, void* blocks, int flags );
+void CompressImageParallel( u8 const* rgba, int width, int height, void* blocks, int flags, float targetError = 0.0f, int threadCount = 0 );
 
 // -----------------------------------------------------------------------------
 
@@ -241,6 +267,23 @@ void DecompressImage( u8* rgba, int width, int height, void const* blocks, int f
 
 // -----------------------------------------------------------------------------
 
+/*! @brief Decompresses an image in memory using multiple threads.
+
+	@param rgba			Storage for the decompressed pixels.
+	@param width		The width of the source image.
+	@param height		The height of the source image.
+	@param blocks		The compressed DXT blocks.
+	@param flags		Compression flags.
+	@param threadCount	The maximum number of threads, or 0 for one per core.
+	
+	The output is identical to squish::DecompressImage. The rows of blocks are 
+	shared out in the same way as squish::CompressImageParallel. Small images 
+	are decompressed on the calling thread.
+*/
+void DecompressImageParallel( u8* rgba, int width, int height, void const* blocks, int flags, int threadCount = 0 );
+
+// -----------------------------------------------------------------------------
+
 } // namespace squish
 
 #endif // ndef SQUISH_H
@@ -34,6 +34,13 @@
 
 #endif // WIN32
 
+#if FSH_STANDALONE_CORE
+
+// The core library is built without the Photoshop SDK.
+#include "PortableTypes.h"
+
+#else
+
 #pragma warning(push)
 #pragma warning(disable: 4121)
 
@@ -43,4 +50,6 @@
 
 #pragma warning(pop)
 
+#endif // FSH_STANDALONE_CORE
+
 #endif // !COMMON_H
\ No newline at end of file
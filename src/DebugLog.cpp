@@ -0,0 +1,45 @@
+/*
+*  This file is part of FshFormat, a file format plug-in for Adobe Photoshop(R)
+*  that loads and saves FSH images.
+*
+*  Copyright (C) 2011, 2012, 2013, 2014, 2015, 2022, 2023 Nicholas Hayes
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+
+#include "DebugLog.h"
+#include <stdarg.h>
+#include <stdio.h>
+
+void DebugLog(const char* format, ...)
+{
+#ifdef _DEBUG
+    char message[256];
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+#if WIN32
+    OutputDebugStringA(message);
+#else
+    fputs(message, stderr);
+#endif // WIN32
+#else
+    UNREFERENCED_PARAMETER(format);
+#endif // _DEBUG
+}
@@ -20,65 +20,10 @@
 */
 
 #include "DxtComp.h"
-
-static int ScoreDXT(const unsigned int (&px)[16], const int nstep, const unsigned int col1, const unsigned int col2, unsigned int* pack)
-{
-    int vec[3];
-
-    const unsigned char* c1 = reinterpret_cast<const unsigned char*>(&col1);
-    const unsigned char* c2 = reinterpret_cast<const unsigned char*>(&col2);
-
-    int colorDistance[3];
-
-    colorDistance[0] = c2[0] - c1[0];
-    colorDistance[1] = c2[1] - c1[1];
-    colorDistance[2] = c2[2] - c1[2];
-
-    int colorDistanceSquared = ((colorDistance[0] * colorDistance[0]) + (colorDistance[1] * colorDistance[1])) + (colorDistance[2] * colorDistance[2]);
-
-    int score = 0;
-    pack[0] = 0L;
-
-    for (int i = 15; i >= 0; i--)
-    {
-        const unsigned char* ptr = reinterpret_cast<const unsigned char*>(px + i);
-        int choice = 0;
-
-        vec[0] = ptr[0] - c1[0];
-        vec[1] = ptr[1] - c1[1];
-        vec[2] = ptr[2] - c1[2];
-
-        int xa2 = ((vec[0] * vec[0]) + (vec[1] * vec[1])) + (vec[2] * vec[2]);
-        int xav = ((vec[0] * colorDistance[0]) + (vec[1] * colorDistance[1])) + (vec[2] * colorDistance[2]);
-        if (colorDistanceSquared > 0)
-        {
-            choice = ((nstep * xav) + (colorDistanceSquared >> 1)) / colorDistanceSquared;
-
-            if (choice < 0)
-            {
-                choice = 0;
-            }
-            else if (choice > nstep)
-            {
-                choice = nstep;
-            }
-        }
-
-        score += (xa2 - (((2 * choice) * xav) / nstep)) + (((choice * choice) * colorDistanceSquared) / (nstep * nstep));
-        pack[0] = pack[0] << 2;
-
-        if (choice == nstep)
-        {
-            pack[0] += 1UL;
-        }
-        else if (choice > 0)
-        {
-            pack[0] += static_cast<unsigned int>(choice + 1);
-        }
-    }
-
-    return score;
-}
+#include "DxtScore.h"
+#include <atomic>
+#include <thread>
+#include <vector>
 
 static void PackDXT(const unsigned int (&px)[16], unsigned char* dest)
 {
@@ -124,8 +69,14 @@ static void PackDXT(const unsigned int (&px)[16], unsigned char* dest)
         {
             for (j = i + 1; j < uniqueColorCount; j++)
             {
+#if DXTCOMP_USE_SSE2
+                int err;
+                int err3;
+                ScoreDXTPair(px, uniqueColors[i], uniqueColors[j], &err, &err3);
+#else
                 unsigned int dst;
                 int err = ScoreDXT(px, 2, uniqueColors[i], uniqueColors[j], &dst);
+#endif
                 if (err < bestErr)
                 {
                     bestCol1 = uniqueColors[i];
@@ -133,7 +84,11 @@ static void PackDXT(const unsigned int (&px)[16], unsigned char* dest)
                     nstep = 2;
                     bestErr = err;
                 }
+#if DXTCOMP_USE_SSE2
+                err = err3;
+#else
                 err = ScoreDXT(px, 3, uniqueColors[i], uniqueColors[j], &dst);
+#endif
                 if (err < bestErr)
                 {
                     bestCol1 = uniqueColors[i];
@@ -165,89 +120,147 @@ static void PackDXT(const unsigned int (&px)[16], unsigned char* dest)
     ScoreDXT(px, nstep, bestCol1, bestCol2, reinterpret_cast<unsigned int*>(dest + 4));
 }
 
-void CompressFSHToolDXT1(const unsigned char* inData, unsigned char* outData, const int width, const int height)
+// Images with fewer blocks per thread than this are compressed on the calling thread.
+static const int MinBlocksPerThread = 256;
+
+static void GatherDXTPixels(const unsigned char* inData, const int stride, const int row, const int x, unsigned int (&dxtPixels)[16])
 {
-    if ((height & 3) == 0 && (width & 3) == 0)
+    const int col = x * 16;
+    for (int i = 0; i < 4; i++)
     {
-        const int blockHeight = height / 4;
-        const int blockWidth = width / 4;
-        const int stride = 4 * width;
+        const int dxtRow = i * 4;
+        const unsigned char* p = (inData + ((row + i) * stride)) + col;
+        for (int j = 0; j < 4; j++)
+        {
+            const int ofs = j * 4;
+            dxtPixels[dxtRow + j] = static_cast<unsigned int>(((p[ofs] << 16) + (p[ofs + 1] << 8)) + p[ofs + 2]);
+        }
+    }
+}
 
-        unsigned int dxtPixels[16];
+static void CompressDXT1BlockRow(const unsigned char* inData, unsigned char* outData, const int width, const int y)
+{
+    const int blockWidth = width / 4;
+    const int stride = 4 * width;
+    const int row = y * 4;
 
-        for (int y = 0; y < blockHeight; y++)
+    unsigned int dxtPixels[16];
+
+    for (int x = 0; x < blockWidth; x++)
+    {
+        GatherDXTPixels(inData, stride, row, x, dxtPixels);
+
+        PackDXT(dxtPixels, outData + (((y * 2) * width) + (x * 8)));
+    }
+}
+
+// Writes the explicit alpha and the colour block of each DXT3 block in a single pass over the row.
+static void CompressDXT3BlockRow(const unsigned char* inData, unsigned char* outData, const int width, const int y)
+{
+    const int blockWidth = width / 4;
+    const int stride = 4 * width;
+    const int row = y * 4;
+
+    unsigned int dxtPixels[16];
+
+    for (int x = 0; x < blockWidth; x++)
+    {
+        unsigned char* block = outData + (((y * 4) * width) + (x * 16));
+        const int alphaCol = (x * 16) + 3;
+
+        for (int i = 0; i < 4; i++)
         {
-            const int row = y * 4;
-            for (int x = 0; x < blockWidth; x++)
-            {
-                const int col = x * 16;
-                for (int i = 0; i < 4; i++)
-                {
-                    const int dxtRow = i * 4;
-                    const unsigned char* p = (inData + ((row + i) * stride)) + col;
-                    for (int j = 0; j < 4; j++)
-                    {
-                        const int ofs = j * 4;
-                        dxtPixels[dxtRow + j] = static_cast<unsigned int>(((p[ofs] << 16) + (p[ofs + 1] << 8)) + p[ofs + 2]);
-                    }
-                }
+            const unsigned char* p = (inData + ((row + i) * stride)) + alphaCol;
+            unsigned char* tgt = block + i * 2;
 
-                PackDXT(dxtPixels, outData + (((y * 2) * width) + (x * 8)));
-            }
+            tgt[0] = static_cast<unsigned char>(((p[0] & 0xf0) >> 4) + (p[4] & 0xf0));
+            tgt[1] = static_cast<unsigned char>(((p[8] & 0xf0) >> 4) + (p[12] & 0xf0));
         }
+
+        GatherDXTPixels(inData, stride, row, x, dxtPixels);
+
+        PackDXT(dxtPixels, block + 8);
     }
 }
 
-void CompressFSHToolDXT3(const unsigned char* inData, unsigned char* outData, const int width, const int height)
+typedef void (*CompressBlockRowProc)(const unsigned char* inData, unsigned char* outData, const int width, const int y);
+
+// The block rows are handed out to the calling thread and the worker threads as each one
+// finishes its previous row, the output of every row is independent of the others.
+static void CompressBlockRows(CompressBlockRowProc compressRow, const unsigned char* inData, unsigned char* outData, const int width, const int height)
 {
-    if ((height & 3) == 0 && (width & 3) == 0)
-    {
-        const int blockHeight = height / 4;
-        const int blockWidth = width / 4;
-        const int stride = 4 * width;
+    const int blockHeight = height / 4;
+    const int blockCount = blockHeight * (width / 4);
 
-        unsigned int dxtPixels[16];
-        int row, col, ofs, dxtRow;
+    int threadCount = static_cast<int>(std::thread::hardware_concurrency());
+    if (threadCount > (blockCount / MinBlocksPerThread))
+    {
+        threadCount = blockCount / MinBlocksPerThread;
+    }
+    if (threadCount > blockHeight)
+    {
+        threadCount = blockHeight;
+    }
 
+    if (threadCount <= 1)
+    {
         for (int y = 0; y < blockHeight; y++)
         {
-            row = y * 4;
-            for (int x = 0; x < blockWidth; x++)
-            {
-                col = x * 16;
-                for (int i = 0; i < 4; i++)
-                {
-                    dxtRow = i * 4;
-                    const unsigned char* p = (inData + ((row + i) * stride)) + col;
-
-                    for (int j = 0; j < 4; j++)
-                    {
-                        ofs = j * 4;
-                        dxtPixels[dxtRow + j] = static_cast<unsigned int>(((p[ofs] << 16) + (p[ofs + 1] << 8)) + p[ofs + 2]);
-                    }
-                }
-
-                PackDXT(dxtPixels, outData + (((((y * 4) * width)) + (x * 16)) + 8));
-            }
+            compressRow(inData, outData, width, y);
         }
+        return;
+    }
 
-        for (int y = 0; y < blockHeight; y++)
+    std::atomic<int> nextRow(0);
+
+    auto worker = [&]()
+    {
+        for (;;)
         {
-            row = y * 4;
-            dxtRow = row * width;
-            for (int x = 0; x < blockWidth; x++)
+            const int y = nextRow.fetch_add(1);
+            if (y >= blockHeight)
             {
-                ofs = x * 16;
-                col = ofs + 3; // get the alpha offset
-                for (int i = 0; i < 4; i++)
-                {
-                    const unsigned char* p = (inData + ((row + i) * stride)) + col;
-                    unsigned char* tgt = outData + (dxtRow + ofs) + i * 2;
-
-                    tgt[0] = static_cast<unsigned char>(((p[0] & 0xf0) >> 4) + (p[4] & 0xf0));
-                    tgt[1] = static_cast<unsigned char>(((p[8] & 0xf0) >> 4) + (p[12] & 0xf0));
-                }
+                break;
             }
+
+            compressRow(inData, outData, width, y);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    try
+    {
+        threads.reserve(threadCount - 1);
+        for (int i = 1; i < threadCount; i++)
+        {
+            threads.push_back(std::thread(worker));
         }
     }
-}
\ No newline at end of file
+    catch (...)
+    {
+        // The threads that did start share the remaining rows.
+    }
+
+    worker();
+
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+        threads[i].join();
+    }
+}
+
+void CompressFSHToolDXT1(const unsigned char* inData, unsigned char* outData, const int width, const int height)
+{
+    if ((height & 3) == 0 && (width & 3) == 0)
+    {
+        CompressBlockRows(CompressDXT1BlockRow, inData, outData, width, height);
+    }
+}
+
+void CompressFSHToolDXT3(const unsigned char* inData, unsigned char* outData, const int width, const int height)
+{
+    if ((height & 3) == 0 && (width & 3) == 0)
+    {
+        CompressBlockRows(CompressDXT3BlockRow, inData, outData, width, height);
+    }
+}
@@ -0,0 +1,203 @@
+/*
+*  This file is part of FshFormat, a file format plug-in for Adobe Photoshop(R)
+*  that loads and saves FSH images.
+*
+*  Copyright (C) 2011, 2012, 2013, 2014, 2015, 2022, 2023 Nicholas Hayes
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+
+#ifndef DXTSCORE_H
+#define DXTSCORE_H
+
+// The colour pair error functions of the FSHTool DXT compressor.
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DXTCOMP_USE_SSE2 1
+#include <emmintrin.h>
+#else
+#define DXTCOMP_USE_SSE2 0
+#endif
+
+static inline int ScoreDXT(const unsigned int (&px)[16], const int nstep, const unsigned int col1, const unsigned int col2, unsigned int* pack)
+{
+    int vec[3];
+
+    const unsigned char* c1 = reinterpret_cast<const unsigned char*>(&col1);
+    const unsigned char* c2 = reinterpret_cast<const unsigned char*>(&col2);
+
+    int colorDistance[3];
+
+    colorDistance[0] = c2[0] - c1[0];
+    colorDistance[1] = c2[1] - c1[1];
+    colorDistance[2] = c2[2] - c1[2];
+
+    int colorDistanceSquared = ((colorDistance[0] * colorDistance[0]) + (colorDistance[1] * colorDistance[1])) + (colorDistance[2] * colorDistance[2]);
+
+    int score = 0;
+    pack[0] = 0L;
+
+    for (int i = 15; i >= 0; i--)
+    {
+        const unsigned char* ptr = reinterpret_cast<const unsigned char*>(px + i);
+        int choice = 0;
+
+        vec[0] = ptr[0] - c1[0];
+        vec[1] = ptr[1] - c1[1];
+        vec[2] = ptr[2] - c1[2];
+
+        int xa2 = ((vec[0] * vec[0]) + (vec[1] * vec[1])) + (vec[2] * vec[2]);
+        int xav = ((vec[0] * colorDistance[0]) + (vec[1] * colorDistance[1])) + (vec[2] * colorDistance[2]);
+        if (colorDistanceSquared > 0)
+        {
+            choice = ((nstep * xav) + (colorDistanceSquared >> 1)) / colorDistanceSquared;
+
+            if (choice < 0)
+            {
+                choice = 0;
+            }
+            else if (choice > nstep)
+            {
+                choice = nstep;
+            }
+        }
+
+        score += (xa2 - (((2 * choice) * xav) / nstep)) + (((choice * choice) * colorDistanceSquared) / (nstep * nstep));
+        pack[0] = pack[0] << 2;
+
+        if (choice == nstep)
+        {
+            pack[0] += 1UL;
+        }
+        else if (choice > 0)
+        {
+            pack[0] += static_cast<unsigned int>(choice + 1);
+        }
+    }
+
+    return score;
+}
+
+#if DXTCOMP_USE_SSE2
+// Returns x / 3 for each non-negative lane, using the 32-bit fixed point reciprocal of 3.
+static inline __m128i DivideBy3(__m128i x)
+{
+    const __m128i reciprocal = _mm_set1_epi32(static_cast<int>(0xAAAAAAABU));
+
+    __m128i even = _mm_srli_epi64(_mm_mul_epu32(x, reciprocal), 33);
+    __m128i odd = _mm_srli_epi64(_mm_mul_epu32(_mm_srli_epi64(x, 32), reciprocal), 33);
+
+    return _mm_or_si128(even, _mm_slli_epi64(odd, 32));
+}
+
+static inline __m128i Select(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static inline int HorizontalSum(__m128i v)
+{
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    return _mm_cvtsi128_si32(v);
+}
+
+// Computes the ScoreDXT error of a colour pair for both nstep 2 and nstep 3 with four pixels per vector.
+// The choice index is found by comparing the rounded projection against multiples of the distance instead
+// of dividing, which gives the same result as the clamped integer division for colours that differ.
+static inline void ScoreDXTPair(const unsigned int (&px)[16], const unsigned int col1, const unsigned int col2, int* score2, int* score3)
+{
+    const unsigned char* c1 = reinterpret_cast<const unsigned char*>(&col1);
+    const unsigned char* c2 = reinterpret_cast<const unsigned char*>(&col2);
+
+    const int d0 = c2[0] - c1[0];
+    const int d1 = c2[1] - c1[1];
+    const int d2 = c2[2] - c1[2];
+    const int distanceSquared = ((d0 * d0) + (d1 * d1)) + (d2 * d2);
+
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i color1 = _mm_setr_epi16(c1[0], c1[1], c1[2], 0, c1[0], c1[1], c1[2], 0);
+    const __m128i distance = _mm_setr_epi16(static_cast<short>(d0), static_cast<short>(d1), static_cast<short>(d2), 0,
+        static_cast<short>(d0), static_cast<short>(d1), static_cast<short>(d2), 0);
+    const __m128i rgbMask = _mm_set1_epi32(0x00ffffff);
+
+    const __m128i half = _mm_set1_epi32(distanceSquared >> 1);
+    const __m128i d2x1 = _mm_set1_epi32(distanceSquared - 1);
+    const __m128i d2x2 = _mm_set1_epi32((distanceSquared * 2) - 1);
+    const __m128i d2x3 = _mm_set1_epi32((distanceSquared * 3) - 1);
+
+    const __m128i quarter = _mm_set1_epi32(distanceSquared / 4);
+    const __m128i full = _mm_set1_epi32(distanceSquared);
+    const __m128i ninth = _mm_set1_epi32(distanceSquared / 9);
+    const __m128i fourNinths = _mm_set1_epi32((distanceSquared * 4) / 9);
+
+    __m128i sum2 = zero;
+    __m128i sum3 = zero;
+
+    for (int i = 0; i < 16; i += 4)
+    {
+        const __m128i pixels = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(px + i)), rgbMask);
+
+        const __m128i vecLo = _mm_sub_epi16(_mm_unpacklo_epi8(pixels, zero), color1);
+        const __m128i vecHi = _mm_sub_epi16(_mm_unpackhi_epi8(pixels, zero), color1);
+
+        // madd leaves two partial sums per pixel, the shuffles pair them up for the four pixels.
+        __m128 partLo = _mm_castsi128_ps(_mm_madd_epi16(vecLo, vecLo));
+        __m128 partHi = _mm_castsi128_ps(_mm_madd_epi16(vecHi, vecHi));
+        const __m128i xa2 = _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(partLo, partHi, _MM_SHUFFLE(2, 0, 2, 0))),
+            _mm_castps_si128(_mm_shuffle_ps(partLo, partHi, _MM_SHUFFLE(3, 1, 3, 1))));
+
+        partLo = _mm_castsi128_ps(_mm_madd_epi16(vecLo, distance));
+        partHi = _mm_castsi128_ps(_mm_madd_epi16(vecHi, distance));
+        const __m128i xav = _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(partLo, partHi, _MM_SHUFFLE(2, 0, 2, 0))),
+            _mm_castps_si128(_mm_shuffle_ps(partLo, partHi, _MM_SHUFFLE(3, 1, 3, 1))));
+
+        const __m128i xav2 = _mm_add_epi32(xav, xav);
+
+        // nstep 2: (2 * choice * xav) / 2 is exact and the choice * choice * d / 4 term only has 3 values.
+        const __m128i n2 = _mm_add_epi32(xav2, half);
+        const __m128i n2ge1 = _mm_cmpgt_epi32(n2, d2x1);
+        const __m128i n2ge2 = _mm_cmpgt_epi32(n2, d2x2);
+
+        __m128i term = _mm_add_epi32(_mm_and_si128(n2ge1, xav), _mm_and_si128(n2ge2, xav));
+        __m128i err = Select(n2ge2, full, _mm_and_si128(n2ge1, quarter));
+        sum2 = _mm_add_epi32(sum2, _mm_add_epi32(_mm_sub_epi32(xa2, term), err));
+
+        // nstep 3: a choice above zero implies xav is positive, so the unsigned reciprocal divide is exact.
+        const __m128i xav3 = _mm_add_epi32(xav2, xav);
+        const __m128i n3 = _mm_add_epi32(xav3, half);
+        const __m128i n3ge1 = _mm_cmpgt_epi32(n3, d2x1);
+        const __m128i n3ge2 = _mm_cmpgt_epi32(n3, d2x2);
+        const __m128i n3ge3 = _mm_cmpgt_epi32(n3, d2x3);
+
+        term = _mm_and_si128(n3ge1, DivideBy3(xav2));
+        term = Select(n3ge2, DivideBy3(_mm_add_epi32(xav2, xav2)), term);
+        term = Select(n3ge3, xav2, term);
+
+        err = _mm_and_si128(n3ge1, ninth);
+        err = Select(n3ge2, fourNinths, err);
+        err = Select(n3ge3, full, err);
+
+        sum3 = _mm_add_epi32(sum3, _mm_add_epi32(_mm_sub_epi32(xa2, term), err));
+    }
+
+    *score2 = HorizontalSum(sum2);
+    *score3 = HorizontalSum(sum3);
+}
+#endif
+
+#endif // !DXTSCORE_H
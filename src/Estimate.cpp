@@ -21,9 +21,36 @@
 
 #include "FshFormatPS.h"
 
-static int32 CalculateFshSize(const int imageWidth, const int imageHeight, const Globals* globals)
+// The typical size of QFS compressed image data as a percentage of its uncompressed size.
+// The DXT formats are already compressed, so they only gain from repeated blocks.
+static int GetQFSCompressedPercentage(const FshBmpType code)
 {
-    int32 size = sizeof(FshHeader) + sizeof(FshDirEntry) + sizeof(FshBmpEntry);
+    switch (code)
+    {
+        case DXT1:
+            return 85;
+        case DXT3:
+            return 70;
+        case ThirtyTwoBit:
+        case SixteenBit4x4:
+            return 60;
+        case TwentyFourBit:
+            return 70;
+        case SixteenBit:
+            return 85;
+        case SixteenBitAlpha:
+            return 75;
+    }
+
+    return 100;
+}
+
+// Calculates the size of the file, when compressed is true the QFS compression options are applied
+// using the typical compression ratio of the format.
+static int32 CalculateFshSize(const int imageWidth, const int imageHeight, const Globals* globals, const bool compressed)
+{
+    const int32 headerSize = sizeof(FshHeader) + sizeof(FshDirEntry) + sizeof(FshBmpEntry);
+    int32 size = headerSize;
 
     size += GetImageDataSize(imageWidth, imageHeight, globals->fshCode);
 
@@ -45,6 +72,24 @@ static int32 CalculateFshSize(const int imageWidth, const int imageHeight, const
         }
     }
 
+    if (compressed && (globals->qfsEntryCompression || globals->qfsCompression))
+    {
+        const INT64 dataSize = static_cast<INT64>(size - headerSize);
+        const int32 compressedSize = headerSize + static_cast<int32>((dataSize * GetQFSCompressedPercentage(globals->fshCode)) / 100);
+
+        // Compressing the file again after the entry has been compressed does not make it smaller,
+        // so the whole file compression only applies to uncompressed entries.
+        if (globals->qfsEntryCompression)
+        {
+            size = compressedSize;
+        }
+        else
+        {
+            // The whole file compression is prefixed with the 4 byte compressed length.
+            size = 4 + compressedSize;
+        }
+    }
+
     return size;
 }
 
@@ -57,7 +102,13 @@ OSErr DoEstimatePrepare(FormatRecordPtr pb)
 
 OSErr DoEstimateStart(FormatRecordPtr pb, const Globals* globals)
 {
-    pb->minDataBytes = pb->maxDataBytes = CalculateFshSize(pb->imageSize.h, pb->imageSize.v, globals);
+    // QFS compressed data is only written when it is smaller than the uncompressed data,
+    // so the uncompressed size is the upper bound.
+    const int32 size = CalculateFshSize(pb->imageSize.h, pb->imageSize.v, globals, false);
+    const int32 compressedSize = CalculateFshSize(pb->imageSize.h, pb->imageSize.v, globals, true);
+
+    pb->minDataBytes = compressedSize < size ? compressedSize : size;
+    pb->maxDataBytes = size;
 
     pb->data = nullptr;
     SETRECT(pb->theRect, 0, 0, 0, 0);
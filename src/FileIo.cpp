@@ -19,9 +19,19 @@
 *
 */
 
-#include "PITypes.h"
 #include "FileIo.h"
 
+#if !WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif // !WIN32
+
+#if WIN32
+
 OSErr GetFilePosition(HANDLE hFile, DWORD* filePos)
 {
     DWORD moved = SetFilePointer(hFile, 0, nullptr, FILE_CURRENT);
@@ -62,16 +72,227 @@ OSErr GetFileSize(HANDLE hFile, INT64* size)
     return noErr;
 }
 
-OSErr ReadBytes(HANDLE hFile, void* buffPtr, const DWORD count)
+// Reads up to count bytes, bytesRead is set to zero at the end of the file.
+static OSErr ReadAvailableBytes(HANDLE hFile, void* buffPtr, const DWORD count, DWORD* bytesRead)
 {
-    DWORD bytesRead = 0;
+    *bytesRead = 0;
+
+    if (!ReadFile(hFile, buffPtr, count, bytesRead, nullptr))
+    {
+        return ioErr;
+    }
+
+    return noErr;
+}
+
+OSErr WriteBytes(HANDLE hFile, const void* buffPtr, const DWORD count)
+{
+    DWORD bytesWritten = 0;
+
+    if (!WriteFile(hFile, buffPtr, count, &bytesWritten, nullptr))
+    {
+        return writErr;
+    }
+
+    if (bytesWritten != count)
+    {
+        return ioErr;
+    }
+
+    return noErr;
+}
+
+OSErr TruncateFile(HANDLE hFile)
+{
+    // Sets the end of the file to the current file position.
+    if (!SetEndOfFile(hFile))
+    {
+        return writErr;
+    }
+
+    return noErr;
+}
+
+OSErr OpenFile(const char* path, const bool write, HANDLE* hFile)
+{
+    if (write)
+    {
+        *hFile = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    }
+    else
+    {
+        *hFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    }
+
+    if (*hFile == INVALID_HANDLE_VALUE)
+    {
+        *hFile = nullptr;
+        return ioErr;
+    }
+
+    return noErr;
+}
+
+void CloseFile(HANDLE hFile)
+{
+    CloseHandle(hFile);
+}
+
+#else
+
+static int GetFileDescriptor(HANDLE hFile)
+{
+    return static_cast<int>(reinterpret_cast<intptr_t>(hFile));
+}
+
+OSErr GetFilePosition(HANDLE hFile, DWORD* filePos)
+{
+    const off_t position = lseek(GetFileDescriptor(hFile), 0, SEEK_CUR);
+
+    if (position < 0 || position > static_cast<off_t>(MAXDWORD))
+    {
+        return ioErr;
+    }
+
+    *filePos = static_cast<DWORD>(position);
+
+    return noErr;
+}
 
-    if (!ReadFile(hFile, buffPtr, count, &bytesRead, nullptr))
+OSErr SetFilePosition(HANDLE hFile, const DWORD posMode, const LONG posOff)
+{
+    if (lseek(GetFileDescriptor(hFile), posOff, static_cast<int>(posMode)) < 0)
     {
         return ioErr;
     }
 
-    if (bytesRead != count)
+    return noErr;
+}
+
+OSErr GetFileSize(HANDLE hFile, INT64* size)
+{
+    struct stat info;
+
+    if (fstat(GetFileDescriptor(hFile), &info) != 0)
+    {
+        return ioErr;
+    }
+
+    *size = static_cast<INT64>(info.st_size);
+
+    return noErr;
+}
+
+// Reads up to count bytes, bytesRead is set to zero at the end of the file.
+static OSErr ReadAvailableBytes(HANDLE hFile, void* buffPtr, const DWORD count, DWORD* bytesRead)
+{
+    BYTE* dst = static_cast<BYTE*>(buffPtr);
+    DWORD total = 0;
+
+    while (total < count)
+    {
+        const ssize_t length = read(GetFileDescriptor(hFile), dst + total, count - total);
+
+        if (length < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            *bytesRead = total;
+            return ioErr;
+        }
+        else if (length == 0)
+        {
+            break;
+        }
+
+        total += static_cast<DWORD>(length);
+    }
+
+    *bytesRead = total;
+
+    return noErr;
+}
+
+OSErr WriteBytes(HANDLE hFile, const void* buffPtr, const DWORD count)
+{
+    const BYTE* src = static_cast<const BYTE*>(buffPtr);
+    DWORD total = 0;
+
+    while (total < count)
+    {
+        const ssize_t length = write(GetFileDescriptor(hFile), src + total, count - total);
+
+        if (length < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return writErr;
+        }
+        else if (length == 0)
+        {
+            return ioErr;
+        }
+
+        total += static_cast<DWORD>(length);
+    }
+
+    return noErr;
+}
+
+OSErr TruncateFile(HANDLE hFile)
+{
+    // Sets the end of the file to the current file position.
+    const int fd = GetFileDescriptor(hFile);
+    const off_t position = lseek(fd, 0, SEEK_CUR);
+
+    if (position < 0 || ftruncate(fd, position) != 0)
+    {
+        return writErr;
+    }
+
+    return noErr;
+}
+
+OSErr OpenFile(const char* path, const bool write, HANDLE* hFile)
+{
+    int fd;
+
+    do
+    {
+        fd = write ? open(path, O_RDWR | O_CREAT | O_TRUNC, 0666) : open(path, O_RDONLY);
+    } while (fd < 0 && errno == EINTR);
+
+    if (fd < 0)
+    {
+        *hFile = nullptr;
+        return ioErr;
+    }
+
+    *hFile = reinterpret_cast<HANDLE>(static_cast<intptr_t>(fd));
+
+    return noErr;
+}
+
+void CloseFile(HANDLE hFile)
+{
+    close(GetFileDescriptor(hFile));
+}
+
+#endif // WIN32
+
+OSErr ReadBytes(HANDLE hFile, void* buffPtr, const DWORD count)
+{
+    DWORD bytesRead = 0;
+
+    OSErr e = ReadAvailableBytes(hFile, buffPtr, count, &bytesRead);
+
+    if (e == noErr && bytesRead != count)
     {
         if (bytesRead == 0)
         {
@@ -81,7 +302,7 @@ OSErr ReadBytes(HANDLE hFile, void* buffPtr, const DWORD count)
         return ioErr;
     }
 
-    return noErr;
+    return e;
 }
 
 OSErr ReadInt32(HANDLE hFile, INT32* val)
@@ -112,24 +333,301 @@ OSErr ReadUInt16(HANDLE hFile, UINT16* val)
     return e;
 }
 
-OSErr WriteBytes(HANDLE hFile, const void* buffPtr, const DWORD count)
+OSErr WriteInt32(HANDLE hFile, const INT32 val)
 {
-    DWORD bytesWritten = 0;
+    BYTE buf[4];
 
-    if (!WriteFile(hFile, buffPtr, count, &bytesWritten, nullptr))
+    buf[0] = static_cast<BYTE>(val);
+    buf[1] = static_cast<BYTE>(val >> 8);
+    buf[2] = static_cast<BYTE>(val >> 16);
+    buf[3] = static_cast<BYTE>(val >> 24);
+
+    OSErr e = WriteBytes(hFile, buf, 4);
+
+    return e;
+}
+
+OSErr WriteUInt16(HANDLE hFile, const UINT16 val)
+{
+    BYTE buf[2];
+
+    buf[0] = static_cast<BYTE>(val);
+    buf[1] = static_cast<BYTE>(val >> 8);
+
+    OSErr e = WriteBytes(hFile, buf, 2);
+
+    return e;
+}
+
+FileMapping::FileMapping() : mapping(nullptr), data(nullptr), size(0)
+{
+}
+
+FileMapping::~FileMapping()
+{
+    Close();
+}
+
+OSErr FileMapping::Open(HANDLE hFile)
+{
+    Close();
+
+    INT64 fileSize;
+    OSErr e = GetFileSize(hFile, &fileSize);
+
+    if (e == noErr)
     {
-        return writErr;
+        // Empty files cannot be mapped.
+        if (fileSize <= 0 || fileSize > MAXDWORD)
+        {
+            e = ioErr;
+        }
     }
 
-    if (bytesWritten != count)
+#if WIN32
+    if (e == noErr)
     {
-        return ioErr;
+        mapping = CreateFileMappingW(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+        if (mapping == nullptr)
+        {
+            e = ioErr;
+        }
+        else
+        {
+            data = static_cast<const BYTE*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+
+            if (data == nullptr)
+            {
+                CloseHandle(mapping);
+                mapping = nullptr;
+                e = ioErr;
+            }
+            else
+            {
+                size = static_cast<DWORD>(fileSize);
+            }
+        }
+    }
+#else
+    if (e == noErr)
+    {
+        void* view = mmap(nullptr, static_cast<size_t>(fileSize), PROT_READ, MAP_PRIVATE, GetFileDescriptor(hFile), 0);
+
+        if (view == MAP_FAILED)
+        {
+            e = ioErr;
+        }
+        else
+        {
+            data = static_cast<const BYTE*>(view);
+            size = static_cast<DWORD>(fileSize);
+        }
+    }
+#endif // WIN32
+
+    return e;
+}
+
+void FileMapping::Close()
+{
+#if WIN32
+    if (data != nullptr)
+    {
+        UnmapViewOfFile(data);
+        data = nullptr;
+    }
+
+    if (mapping != nullptr)
+    {
+        CloseHandle(mapping);
+        mapping = nullptr;
+    }
+#else
+    if (data != nullptr)
+    {
+        munmap(const_cast<BYTE*>(data), size);
+        data = nullptr;
     }
+#endif // WIN32
+
+    size = 0;
+}
+
+bool FileMapping::IsOpen() const
+{
+    return data != nullptr;
+}
+
+const BYTE* FileMapping::GetData() const
+{
+    return data;
+}
+
+DWORD FileMapping::GetSize() const
+{
+    return size;
+}
+
+BufferedFileReader::BufferedFileReader(HANDLE hFile) : hFile(hFile), position(0), blockOffset(0), blockLength(0)
+{
+}
+
+OSErr BufferedFileReader::SetPosition(const DWORD offset)
+{
+    position = offset;
 
     return noErr;
 }
 
-OSErr WriteInt32(HANDLE hFile, const INT32 val)
+OSErr BufferedFileReader::ReadBytes(void* buffPtr, const DWORD count)
+{
+    OSErr e = noErr;
+    BYTE* dst = static_cast<BYTE*>(buffPtr);
+    DWORD remaining = count;
+
+    while (e == noErr && remaining > 0)
+    {
+        if (position >= blockOffset && (position - blockOffset) < blockLength)
+        {
+            const DWORD available = blockLength - (position - blockOffset);
+            const DWORD length = remaining < available ? remaining : available;
+
+            memcpy(dst, block + (position - blockOffset), length);
+            dst += length;
+            position += length;
+            remaining -= length;
+        }
+        else
+        {
+            e = SetFilePosition(hFile, FILE_BEGIN, static_cast<LONG>(position));
+
+            if (e == noErr)
+            {
+                if (remaining >= FileIoBlockSize)
+                {
+                    // Large reads bypass the cache.
+                    e = ::ReadBytes(hFile, dst, remaining);
+
+                    if (e == noErr)
+                    {
+                        position += remaining;
+                        remaining = 0;
+                    }
+                }
+                else
+                {
+                    DWORD bytesRead = 0;
+
+                    e = ReadAvailableBytes(hFile, block, FileIoBlockSize, &bytesRead);
+
+                    if (e == noErr && bytesRead == 0)
+                    {
+                        e = eofErr;
+                    }
+
+                    blockOffset = position;
+                    blockLength = e == noErr ? bytesRead : 0;
+                }
+            }
+        }
+    }
+
+    return e;
+}
+
+OSErr BufferedFileReader::ReadInt32(INT32* val)
+{
+    BYTE buf[4];
+
+    OSErr e = ReadBytes(buf, 4);
+
+    if (e == noErr)
+    {
+        *val = static_cast<INT32>(((buf[3] << 24) | (buf[2] << 16) | (buf[1] << 8)) | buf[0]);
+    }
+
+    return e;
+}
+
+OSErr BufferedFileReader::ReadUInt16(UINT16* val)
+{
+    BYTE buf[2];
+
+    OSErr e = ReadBytes(buf, 2);
+
+    if (e == noErr)
+    {
+        *val = static_cast<UINT16>((buf[1] << 8) | buf[0]);
+    }
+
+    return e;
+}
+
+BufferedFileWriter::BufferedFileWriter(HANDLE hFile) : hFile(hFile), blockOffset(0), blockLength(0)
+{
+}
+
+BufferedFileWriter::~BufferedFileWriter()
+{
+    Flush();
+}
+
+OSErr BufferedFileWriter::SetPosition(const DWORD offset)
+{
+    OSErr e = noErr;
+
+    // Writes that continue the pending data are coalesced.
+    if (offset != (blockOffset + blockLength))
+    {
+        e = Flush();
+
+        if (e == noErr)
+        {
+            blockOffset = offset;
+        }
+    }
+
+    return e;
+}
+
+OSErr BufferedFileWriter::WriteBytes(const void* buffPtr, const DWORD count)
+{
+    OSErr e = noErr;
+
+    if ((blockLength + count) > FileIoBlockSize)
+    {
+        e = Flush();
+    }
+
+    if (e == noErr)
+    {
+        if (count >= FileIoBlockSize)
+        {
+            // Large writes bypass the cache.
+            e = SetFilePosition(hFile, FILE_BEGIN, static_cast<LONG>(blockOffset));
+
+            if (e == noErr)
+            {
+                e = ::WriteBytes(hFile, buffPtr, count);
+
+                if (e == noErr)
+                {
+                    blockOffset += count;
+                }
+            }
+        }
+        else
+        {
+            memcpy(block + blockLength, buffPtr, count);
+            blockLength += count;
+        }
+    }
+
+    return e;
+}
+
+OSErr BufferedFileWriter::WriteInt32(const INT32 val)
 {
     BYTE buf[4];
 
@@ -138,19 +636,38 @@ OSErr WriteInt32(HANDLE hFile, const INT32 val)
     buf[2] = static_cast<BYTE>(val >> 16);
     buf[3] = static_cast<BYTE>(val >> 24);
 
-    OSErr e = WriteBytes(hFile, buf, 4);
-
-    return e;
+    return WriteBytes(buf, 4);
 }
 
-OSErr WriteUInt16(HANDLE hFile, const UINT16 val)
+OSErr BufferedFileWriter::WriteUInt16(const UINT16 val)
 {
     BYTE buf[2];
 
     buf[0] = static_cast<BYTE>(val);
     buf[1] = static_cast<BYTE>(val >> 8);
 
-    OSErr e = WriteBytes(hFile, buf, 2);
+    return WriteBytes(buf, 2);
+}
+
+OSErr BufferedFileWriter::Flush()
+{
+    OSErr e = noErr;
+
+    if (blockLength > 0)
+    {
+        e = SetFilePosition(hFile, FILE_BEGIN, static_cast<LONG>(blockOffset));
+
+        if (e == noErr)
+        {
+            e = ::WriteBytes(hFile, block, blockLength);
+
+            if (e == noErr)
+            {
+                blockOffset += blockLength;
+                blockLength = 0;
+            }
+        }
+    }
 
     return e;
-}
+}
\ No newline at end of file
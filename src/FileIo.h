@@ -33,5 +33,83 @@ OSErr ReadUInt16(HANDLE hFile, UINT16* val);
 OSErr WriteBytes(HANDLE hFile, const void* buffPtr, const DWORD count);
 OSErr WriteInt32(HANDLE hFile, const INT32 val);
 OSErr WriteUInt16(HANDLE hFile, const UINT16 val);
+OSErr TruncateFile(HANDLE hFile);
+// Opens a file for the command line tools, the plug-in uses the file handles that the host provides.
+// Files opened for writing are created or truncated and can also be read.
+OSErr OpenFile(const char* path, const bool write, HANDLE* hFile);
+void CloseFile(HANDLE hFile);
+
+// Maps a whole file into memory for read-only access, using a file mapping on Windows and mmap elsewhere.
+class FileMapping
+{
+public:
+	FileMapping();
+	~FileMapping();
+
+	OSErr Open(HANDLE hFile);
+	void Close();
+
+	bool IsOpen() const;
+	const BYTE* GetData() const;
+	DWORD GetSize() const;
+
+private:
+	FileMapping(const FileMapping& copyMe);
+
+	// The file mapping object, POSIX builds only use the view.
+	HANDLE mapping;
+	const BYTE* data;
+	DWORD size;
+};
+
+// The size of the blocks that are cached by the buffered reader and writer.
+const DWORD FileIoBlockSize = 4096;
+
+// Reads a file through a read-ahead block cache, the reader starts at the beginning of the file.
+class BufferedFileReader
+{
+public:
+	explicit BufferedFileReader(HANDLE hFile);
+
+	OSErr SetPosition(const DWORD offset);
+	OSErr ReadBytes(void* buffPtr, const DWORD count);
+	OSErr ReadInt32(INT32* val);
+	OSErr ReadUInt16(UINT16* val);
+
+private:
+	BufferedFileReader(const BufferedFileReader& copyMe);
+
+	HANDLE hFile;
+	DWORD position;
+	// The file offset of the first byte in the block.
+	DWORD blockOffset;
+	DWORD blockLength;
+	BYTE block[FileIoBlockSize];
+};
+
+// Coalesces sequential writes into a block that is written when it is full or when Flush is called,
+// the writer starts at the beginning of the file.
+class BufferedFileWriter
+{
+public:
+	explicit BufferedFileWriter(HANDLE hFile);
+	// Flushes any pending data, call Flush first to get the error code.
+	~BufferedFileWriter();
+
+	OSErr SetPosition(const DWORD offset);
+	OSErr WriteBytes(const void* buffPtr, const DWORD count);
+	OSErr WriteInt32(const INT32 val);
+	OSErr WriteUInt16(const UINT16 val);
+	OSErr Flush();
+
+private:
+	BufferedFileWriter(const BufferedFileWriter& copyMe);
+
+	HANDLE hFile;
+	// The file offset of the first byte in the block.
+	DWORD blockOffset;
+	DWORD blockLength;
+	BYTE block[FileIoBlockSize];
+};
 
 #endif
\ No newline at end of file
@@ -0,0 +1,47 @@
+/*
+*  This file is part of FshFormat, a file format plug-in for Adobe Photoshop(R)
+*  that loads and saves FSH images.
+*
+*  Copyright (C) 2011, 2012, 2013, 2014, 2015, 2022, 2023 Nicholas Hayes
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+
+#ifndef FSHALLOCATOR_H
+#define FSHALLOCATOR_H
+
+#include "Common.h"
+
+// Allocates the image and file buffers used by the core library, the plug-in uses the
+// Photoshop Buffer suite and the command line tool uses the C++ heap.
+class FshAllocator
+{
+public:
+	virtual ~FshAllocator() {}
+
+	// Returns memFullErr and sets data to nullptr if the memory cannot be allocated.
+	virtual OSErr Allocate(const DWORD size, void** data) = 0;
+	virtual void Free(void* data) = 0;
+};
+
+class HeapAllocator : public FshAllocator
+{
+public:
+	OSErr Allocate(const DWORD size, void** data) override;
+	void Free(void* data) override;
+};
+
+#endif // !FSHALLOCATOR_H
@@ -0,0 +1,323 @@
+/*
+*  This file is part of FshFormat, a file format plug-in for Adobe Photoshop(R)
+*  that loads and saves FSH images.
+*
+*  Copyright (C) 2011, 2012, 2013, 2014, 2015, 2022, 2023 Nicholas Hayes
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include "FshArchiveIndex.h"
+#include "FileIo.h"
+#include <algorithm>
+#include <limits.h>
+#include <new>
+
+static INT32 ReadLittleEndianInt32(const BYTE* data)
+{
+    return static_cast<INT32>(((data[3] << 24) | (data[2] << 16) | (data[1] << 8)) | data[0]);
+}
+
+FshArchiveIndex::FshArchiveIndex() : file(nullptr), header()
+{
+}
+
+OSErr FshArchiveIndex::Load(HANDLE file)
+{
+    this->file = file;
+
+    OSErr e = noErr;
+
+    try
+    {
+        reader.reset(new BufferedFileReader(file));
+    }
+    catch (const std::bad_alloc&)
+    {
+        e = memFullErr;
+    }
+
+    if (e == noErr)
+    {
+        // The header and the start of the directory are read in the same block.
+        e = ReadFshHeader(*reader, &header);
+    }
+
+    if (e == noErr && (header.numBmps < 1 || header.numBmps > ((INT_MAX - static_cast<int>(sizeof(FshHeader))) / static_cast<int>(sizeof(FshDirEntry)))))
+    {
+        e = formatCannotRead;
+    }
+
+    if (e == noErr)
+    {
+        const int count = header.numBmps;
+        const DWORD directoryLength = static_cast<DWORD>(count) * sizeof(FshDirEntry);
+
+        try
+        {
+            std::unique_ptr<BYTE[]> directory(new BYTE[directoryLength]);
+
+            const BYTE* data;
+            e = GetInMemoryFshData(sizeof(FshHeader), directoryLength, &data);
+
+            if (e == noErr && data != nullptr)
+            {
+                memcpy(directory.get(), data, directoryLength);
+            }
+            else if (e == noErr)
+            {
+                e = reader->SetPosition(sizeof(FshHeader));
+
+                if (e == noErr)
+                {
+                    e = reader->ReadBytes(directory.get(), directoryLength);
+                }
+            }
+
+            if (e == noErr)
+            {
+                dirEntries.reset(new FshDirEntry[count]);
+                nextOffsets.reset(new INT32[count]);
+                bmpEntries.reset(new FshBmpEntry[count]);
+                bmpEntryRead.reset(new bool[count]);
+                mipCounts.reset(new int[count]);
+                mipPacked.reset(new bool[count]);
+
+                std::unique_ptr<INT32[]> sortedOffsets(new INT32[count]);
+
+                for (int i = 0; i < count; i++)
+                {
+                    const BYTE* item = directory.get() + (i * sizeof(FshDirEntry));
+
+                    memcpy(dirEntries[i].name, item, 4);
+                    dirEntries[i].offset = ReadLittleEndianInt32(item + 4);
+                    sortedOffsets[i] = dirEntries[i].offset;
+                    bmpEntryRead[i] = false;
+                    mipCounts[i] = -1;
+                    mipPacked[i] = false;
+                }
+
+                std::sort(sortedOffsets.get(), sortedOffsets.get() + count);
+
+                for (int i = 0; i < count; i++)
+                {
+                    const INT32* next = std::upper_bound(sortedOffsets.get(), sortedOffsets.get() + count, dirEntries[i].offset);
+
+                    nextOffsets[i] = next != (sortedOffsets.get() + count) && *next < header.size ? *next : header.size;
+                }
+            }
+        }
+        catch (const std::bad_alloc&)
+        {
+            e = memFullErr;
+        }
+    }
+
+    return e;
+}
+
+HANDLE FshArchiveIndex::GetFile() const
+{
+    return file;
+}
+
+const FshHeader& FshArchiveIndex::GetHeader() const
+{
+    return header;
+}
+
+int FshArchiveIndex::GetEntryCount() const
+{
+    return header.numBmps;
+}
+
+const FshDirEntry& FshArchiveIndex::GetDirEntry(const int index) const
+{
+    return dirEntries[index];
+}
+
+INT32 FshArchiveIndex::GetNextOffset(const int index) const
+{
+    return nextOffsets[index];
+}
+
+INT32 FshArchiveIndex::GetEntrySize(const int index) const
+{
+    return nextOffsets[index] - dirEntries[index].offset;
+}
+
+OSErr FshArchiveIndex::GetBmpEntry(const int index, FshBmpEntry* entry)
+{
+    OSErr e = noErr;
+
+    if (!bmpEntryRead[index])
+    {
+        e = ReadFshEntryDir(*reader, dirEntries[index], &bmpEntries[index]);
+
+        if (e == noErr)
+        {
+            bmpEntryRead[index] = true;
+        }
+    }
+
+    if (e == noErr)
+    {
+        *entry = bmpEntries[index];
+    }
+
+    return e;
+}
+
+OSErr FshArchiveIndex::GetMipCount(const int index, int* count, bool* packed)
+{
+    OSErr e = noErr;
+
+    if (mipCounts[index] < 0)
+    {
+        FshBmpEntry entry;
+
+        e = GetBmpEntry(index, &entry);
+
+        if (e == noErr)
+        {
+            int entryCount;
+            bool entryPacked;
+
+            e = CountMipMaps(index, entry, &entryCount, &entryPacked);
+
+            if (e == noErr)
+            {
+                mipCounts[index] = entryCount;
+                mipPacked[index] = entryPacked;
+            }
+        }
+    }
+
+    if (e == noErr)
+    {
+        *count = mipCounts[index];
+        *packed = mipPacked[index];
+    }
+
+    return e;
+}
+
+OSErr FshArchiveIndex::CountMipMaps(const int index, const FshBmpEntry& entry, int* count, bool* packed) const
+{
+    OSErr e = noErr;
+
+    *count = 0;
+    *packed = false;
+    const bool compressed = (entry.code & 0x80) != 0;
+    const FshDirEntry& dir = dirEntries[index];
+
+    if ((entry.misc[3] & 0x0FFF) == 0) // multiscale bitmaps
+    {
+        int numScales = (entry.misc[3] >> 12) & 0x0F;
+        if ((entry.width % (1 << numScales)) != 0 || (entry.height % (1 << numScales)) != 0)
+        {
+            numScales = 0;
+        }
+
+        if (numScales > 0)
+        {
+            const FshBmpType code = static_cast<FshBmpType>(entry.code & 0x7F);
+
+            UINT32 mbpLen = 0;
+            UINT32 mbpPadLen = 0;
+
+            for (int i = 0; i <= numScales; i++)
+            {
+                const int width = entry.width >> i;
+                const int height = entry.height >> i;
+
+                UINT32 dataLength = 0;
+
+                switch (code)
+                {
+                case DXT1:
+                    // DXT1 images must be padded to a multiple of four.
+                    dataLength = ((((width + 3) & ~3) * ((height + 3) & ~3)) / 2);
+                    break;
+                case DXT3:
+                    dataLength = (width * height);
+                    break;
+                case ThirtyTwoBit:
+                    dataLength = (width * height * 4);
+                    break;
+                case TwentyFourBit:
+                    dataLength = (width * height * 3);
+                    break;
+                case SixteenBit:
+                case SixteenBitAlpha:
+                case SixteenBit4x4:
+                    dataLength = (width * height * 2);
+                    break;
+                }
+
+                mbpLen += dataLength;
+                mbpPadLen += dataLength;
+
+                // DXT1 mipmaps smaller than 4x4 are also padded
+                int padLength = ((16 - static_cast<INT64>(mbpLen)) & 15);
+                if (padLength > 0)
+                {
+                    mbpLen += padLength;
+                    if (i == numScales)
+                    {
+                        mbpPadLen += padLength;
+                    }
+                }
+            }
+
+            if (compressed)
+            {
+                // The mipmaps are stored in the same QFS stream as the full size image.
+                int uncompressedSize;
+
+                e = GetEntryUncompressedSize(file, dir, &uncompressedSize);
+
+                if (e == noErr && static_cast<UINT32>(uncompressedSize) != mbpLen)
+                {
+                    *packed = true;
+                    if (static_cast<UINT32>(uncompressedSize) != mbpPadLen)
+                    {
+                        numScales = 0;
+                    }
+                }
+            }
+            else
+            {
+                const UINT32 entryLength = static_cast<UINT32>(entry.code >> 8);
+                const UINT32 nextOffset = static_cast<UINT32>(nextOffsets[index]);
+
+                if ((entryLength != 0 && entryLength != (mbpLen + sizeof(FshBmpEntry))) ||
+                    (entryLength == 0 && (mbpLen + dir.offset + sizeof(FshBmpEntry)) != nextOffset))
+                {
+                    *packed = true;
+                    if ((entryLength != 0 && entryLength != (mbpPadLen + sizeof(FshBmpEntry))) ||
+                        (entryLength == 0 && (mbpPadLen + dir.offset + sizeof(FshBmpEntry)) != nextOffset))
+                    {
+                        numScales = 0;
+                    }
+                }
+            }
+
+            *count = numScales;
+        }
+    }
+
+    return e;
+}
@@ -0,0 +1,68 @@
+/*
+*  This file is part of FshFormat, a file format plug-in for Adobe Photoshop(R)
+*  that loads and saves FSH images.
+*
+*  Copyright (C) 2011, 2012, 2013, 2014, 2015, 2022, 2023 Nicholas Hayes
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#ifndef FSHARCHIVEINDEX_H
+#define FSHARCHIVEINDEX_H
+
+#include "Common.h"
+#include "FshIo.h"
+#include <memory>
+
+// Caches the header and directory of a FSH file, the entry offsets are sorted once when the directory is loaded.
+class FshArchiveIndex
+{
+public:
+	FshArchiveIndex();
+
+	// Reads the header and the whole directory.
+	OSErr Load(HANDLE file);
+
+	HANDLE GetFile() const;
+	const FshHeader& GetHeader() const;
+	int GetEntryCount() const;
+	const FshDirEntry& GetDirEntry(const int index) const;
+	// Gets the offset of the entry that follows the specified entry in the file, or the file size for the last entry.
+	INT32 GetNextOffset(const int index) const;
+	// Gets the size of the entry including its FshBmpEntry header.
+	INT32 GetEntrySize(const int index) const;
+	// Gets the bitmap entry, each entry is read from the file the first time it is requested.
+	OSErr GetBmpEntry(const int index, FshBmpEntry* entry);
+	// Counts the number of mipmaps contained in the specified image entry.
+	OSErr GetMipCount(const int index, int* count, bool* packed);
+
+private:
+	FshArchiveIndex(const FshArchiveIndex& copyMe);
+
+	OSErr CountMipMaps(const int index, const FshBmpEntry& entry, int* count, bool* packed) const;
+
+	HANDLE file;
+	std::unique_ptr<BufferedFileReader> reader;
+	FshHeader header;
+	std::unique_ptr<FshDirEntry[]> dirEntries;
+	std::unique_ptr<INT32[]> nextOffsets;
+	std::unique_ptr<FshBmpEntry[]> bmpEntries;
+	std::unique_ptr<bool[]> bmpEntryRead;
+	// The mipmap count of each entry, or -1 if it has not been counted.
+	std::unique_ptr<int[]> mipCounts;
+	std::unique_ptr<bool[]> mipPacked;
+};
+
+#endif
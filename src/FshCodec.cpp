@@ -0,0 +1,1034 @@
+/*
+*  This file is part of FshFormat, a file format plug-in for Adobe Photoshop(R)
+*  that loads and saves FSH images.
+*
+*  Copyright (C) 2011, 2012, 2013, 2014, 2015, 2022, 2023 Nicholas Hayes
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+
+#include "FshCodec.h"
+#include "DebugLog.h"
+#include "DxtComp.h"
+#include "SixteenBitPixels.h"
+#include "squish.h"
+#include <chrono>
+#include <condition_variable>
+#include <math.h>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <system_error>
+#include <thread>
+
+int GetFshBmpChannelCount(const FshBmpType code)
+{
+    return (code == TwentyFourBit || code == SixteenBit) ? 3 : 4;
+}
+
+int GetFshImageRowOffset(const FshBmpType code, const int width, const int row)
+{
+    switch (code)
+    {
+    case DXT1:
+        return (row / 4) * ((width + 3) / 4) * 8;
+    case DXT3:
+        return (row / 4) * ((width + 3) / 4) * 16;
+    case TwentyFourBit:
+        return row * width * 3;
+    case ThirtyTwoBit:
+        return row * width * 4;
+    default:
+        return row * width * 2;
+    }
+}
+
+// Expands the 16-bit pixels to 8-bit RGB or RGBA, the low bits of each channel are left as zero.
+static void UnpackSixteenBitPixels(const FshBmpType code, const UINT16* src, const int count, BYTE* dst)
+{
+    switch (code)
+    {
+    case SixteenBit:
+        UnpackPixels<Unpack565>(src, count, dst);
+        break;
+    case SixteenBitAlpha:
+        UnpackPixels<Unpack1555>(src, count, dst);
+        break;
+    case SixteenBit4x4:
+        UnpackPixels<Unpack4444>(src, count, dst);
+        break;
+    default:
+        break;
+    }
+}
+
+void DecodeFshImage(const FshBmpType code, const int width, const int height, const void* data, BYTE* outData)
+{
+    if (code == DXT1 || code == DXT3)
+    {
+        squish::DecompressImageParallel(
+            reinterpret_cast<squish::u8*>(outData),
+            width,
+            height,
+            data,
+            code == DXT1 ? squish::kDxt1 : squish::kDxt3);
+    }
+    else if (code == TwentyFourBit || code == ThirtyTwoBit)
+    {
+        // Swap the BGR(A) image data to RGB(A).
+        const int channels = GetFshBmpChannelCount(code);
+        const BYTE* src = static_cast<const BYTE*>(data);
+        const int pixelCount = width * height;
+
+        for (int i = 0; i < pixelCount; i++)
+        {
+            outData[0] = src[2];
+            outData[1] = src[1];
+            outData[2] = src[0];
+
+            if (channels == 4)
+            {
+                outData[3] = src[3];
+            }
+
+            src += channels;
+            outData += channels;
+        }
+    }
+    else
+    {
+        UnpackSixteenBitPixels(code, static_cast<const UINT16*>(data), width * height, outData);
+    }
+}
+
+static void CompressDxtBlocks(const FshEncodeOptions& options, const BYTE* rgba, BYTE* blocks, const int width, const int height)
+{
+    if (options.squishDxt)
+    {
+        int flags = options.code == DXT1 ? squish::kDxt1 : squish::kDxt3;
+
+        switch (options.dxtQuality)
+        {
+        case DxtQualityFastest:
+            flags |= squish::kColourRangeFit;
+            break;
+        case DxtQualityNormal:
+            flags |= squish::kColourClusterFit;
+            break;
+        case DxtQualityBest:
+        default:
+            flags |= squish::kColourIterativeClusterFit;
+            break;
+        }
+
+        flags |= options.dxtPerceptualMetric ? squish::kColourMetricPerceptual : squish::kColourMetricUniform;
+
+        squish::CompressImageParallel(rgba, width, height, blocks, flags, options.dxtTargetError);
+    }
+    else if (options.code == DXT1)
+    {
+        CompressFSHToolDXT1(rgba, blocks, width, height);
+    }
+    else
+    {
+        CompressFSHToolDXT3(rgba, blocks, width, height);
+    }
+}
+
+static UINT32 HashDxtBlock(const BYTE* rgba, const int stride)
+{
+    // FNV-1a over the 16 pixels of the block.
+    UINT32 hash = 2166136261U;
+
+    for (int y = 0; y < 4; y++)
+    {
+        const UINT32* row = reinterpret_cast<const UINT32*>(rgba + (y * stride));
+
+        for (int x = 0; x < 4; x++)
+        {
+            hash = (hash ^ row[x]) * 16777619U;
+        }
+    }
+
+    return hash;
+}
+
+static bool DxtBlocksEqual(const BYTE* a, const int strideA, const BYTE* b, const int strideB)
+{
+    for (int y = 0; y < 4; y++)
+    {
+        if (memcmp(a + (y * strideA), b + (y * strideB), 16) != 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// The 8-bit source pixels of a DXT image, the DXT encoders only read them when gathering each 4x4 block.
+struct DxtSourceImage
+{
+    const BYTE* data;
+    int width;
+    int height;
+    int rowBytes;
+    int colBytes;
+    // 4 when the image has an alpha channel, 3 when every pixel is opaque.
+    int planes;
+};
+
+// Copies a 4x4 block of the source image into RGBA pixels, stride is the distance between the block rows.
+// Transparent pixels are set to black, images without alpha are made opaque and the pixels
+// past the edge of the image are transparent black.
+static void GatherDxtBlock(const DxtSourceImage& source, const int blockX, const int blockY, BYTE* block, const int stride)
+{
+    const int left = blockX * 4;
+    const int top = blockY * 4;
+    const int columns = (source.width - left) < 4 ? (source.width - left) : 4;
+
+    for (int y = 0; y < 4; y++)
+    {
+        BYTE* out = block + (y * stride);
+        int x = 0;
+
+        if ((top + y) < source.height)
+        {
+            const BYTE* in = source.data + ((top + y) * source.rowBytes) + (left * source.colBytes);
+
+#if FSHCODEC_USE_SSE2
+            if (columns == 4 && source.colBytes == 4)
+            {
+                __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+
+                if (source.planes == 4)
+                {
+                    const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xff000000));
+                    const __m128i transparent = _mm_cmpeq_epi32(_mm_and_si128(pixels, alpha), _mm_setzero_si128());
+
+                    pixels = _mm_andnot_si128(transparent, pixels);
+                }
+                else
+                {
+                    pixels = _mm_or_si128(pixels, _mm_set1_epi32(static_cast<int>(0xff000000)));
+                }
+
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out), pixels);
+                continue;
+            }
+#endif // FSHCODEC_USE_SSE2
+
+            for (; x < columns; x++)
+            {
+                if (source.planes == 4)
+                {
+                    if (in[3] == 0)
+                    {
+                        // Set the color of any transparent pixels to black.
+                        out[0] = 0;
+                        out[1] = 0;
+                        out[2] = 0;
+                    }
+                    else
+                    {
+                        out[0] = in[0];
+                        out[1] = in[1];
+                        out[2] = in[2];
+                    }
+
+                    out[3] = in[3];
+                }
+                else
+                {
+                    // DXTn images require an alpha channel, so we set an opaque one if we do not have any transparency.
+                    out[0] = in[0];
+                    out[1] = in[1];
+                    out[2] = in[2];
+                    out[3] = 255;
+                }
+
+                in += source.colBytes;
+                out += 4;
+            }
+        }
+
+        for (; x < 4; x++)
+        {
+            out[0] = 0;
+            out[1] = 0;
+            out[2] = 0;
+            out[3] = 0;
+            out += 4;
+        }
+    }
+}
+
+// Width in blocks of the image that holds the unique blocks.
+static const int UniqueBlockImageWidth = 64;
+
+// Compresses each distinct 4x4 block only once and returns the compressed blocks in a buffer from the allocator.
+// Each block is gathered from the source straight into the next free cell of a compact image of unique blocks,
+// so the source is read once and no full size RGBA copy is made. The unique image is compressed with the normal
+// encoders and the results are copied to every block that matched. The encoders treat each block independently,
+// so the output is the same as compressing the whole image.
+static OSErr CompressDxtImage(FshAllocator& allocator,
+                              const FshEncodeOptions& options,
+                              const DxtSourceImage& source,
+                              void** compressedData,
+                              int* compressedLength,
+                              FshDxtBlockCounts* blockCounts)
+{
+    // DXTn images must be padded to a multiple of four, this only applies to the smallest mipmaps.
+    const int blocksWide = (source.width + 3) / 4;
+    const int blockCount = blocksWide * ((source.height + 3) / 4);
+    const int blockSize = options.code == DXT1 ? 8 : 16;
+
+    int tableSize = 16;
+    while (tableSize < blockCount * 2)
+    {
+        tableSize *= 2;
+    }
+
+    const int uniqueWidth = blockCount < UniqueBlockImageWidth ? blockCount : UniqueBlockImageWidth;
+    const int uniqueRows = (blockCount + (uniqueWidth - 1)) / uniqueWidth;
+    const int uniqueStride = uniqueWidth * 16;
+
+    void* tableBuf = nullptr;
+    void* blockIndexBuf = nullptr;
+    void* uniqueBuf = nullptr;
+    void* uniqueBlocksBuf = nullptr;
+
+    OSErr e = allocator.Allocate(static_cast<DWORD>(tableSize * sizeof(int)), &tableBuf);
+    if (e == noErr)
+    {
+        e = allocator.Allocate(static_cast<DWORD>(blockCount * sizeof(int)), &blockIndexBuf);
+    }
+    if (e == noErr)
+    {
+        e = allocator.Allocate(static_cast<DWORD>(uniqueStride * uniqueRows * 4), &uniqueBuf);
+    }
+
+    if (e == noErr)
+    {
+        int* table = static_cast<int*>(tableBuf);
+        int* blockIndex = static_cast<int*>(blockIndexBuf);
+        BYTE* unique = static_cast<BYTE*>(uniqueBuf);
+        int uniqueCount = 0;
+
+        memset(table, 0xff, tableSize * sizeof(int));
+
+        for (int i = 0; i < blockCount; i++)
+        {
+            BYTE* block = unique + ((uniqueCount / uniqueWidth) * 4 * uniqueStride) + ((uniqueCount % uniqueWidth) * 16);
+
+            GatherDxtBlock(source, i % blocksWide, i / blocksWide, block, uniqueStride);
+
+            UINT32 slot = HashDxtBlock(block, uniqueStride) & (tableSize - 1);
+
+            for (;;)
+            {
+                const int index = table[slot];
+
+                if (index < 0)
+                {
+                    // Keep the new block in the cell it was gathered into.
+                    table[slot] = uniqueCount;
+                    blockIndex[i] = uniqueCount;
+                    uniqueCount++;
+                    break;
+                }
+
+                const BYTE* cached = unique + ((index / uniqueWidth) * 4 * uniqueStride) + ((index % uniqueWidth) * 16);
+                if (DxtBlocksEqual(block, uniqueStride, cached, uniqueStride))
+                {
+                    blockIndex[i] = index;
+                    break;
+                }
+
+                slot = (slot + 1) & (tableSize - 1);
+            }
+        }
+
+        DebugLog("FshFormat: DXT block cache reused %d of %d blocks (%.1f%%).\n",
+                 blockCount - uniqueCount,
+                 blockCount,
+                 (static_cast<double>(blockCount - uniqueCount) * 100.0) / static_cast<double>(blockCount));
+
+        if (blockCounts != nullptr)
+        {
+            blockCounts->total += blockCount;
+            blockCounts->unique += uniqueCount;
+        }
+
+        // Only compress the rows of the unique image that were used, the unused cells of the last row
+        // are filled with the first block.
+        const int usedRows = (uniqueCount + (uniqueWidth - 1)) / uniqueWidth;
+
+        for (int i = uniqueCount; i < usedRows * uniqueWidth; i++)
+        {
+            BYTE* dst = unique + ((i / uniqueWidth) * 4 * uniqueStride) + ((i % uniqueWidth) * 16);
+
+            for (int y = 0; y < 4; y++)
+            {
+                memcpy(dst + (y * uniqueStride), unique + (y * uniqueStride), 16);
+            }
+        }
+
+        e = allocator.Allocate(static_cast<DWORD>(usedRows * uniqueWidth * blockSize), &uniqueBlocksBuf);
+        if (e == noErr)
+        {
+            BYTE* uniqueBlocks = static_cast<BYTE*>(uniqueBlocksBuf);
+
+            CompressDxtBlocks(options, unique, uniqueBlocks, uniqueWidth * 4, usedRows * 4);
+
+            if (uniqueCount == blockCount)
+            {
+                // Every block was new, so the unique blocks are already in image order.
+                *compressedData = uniqueBlocksBuf;
+                uniqueBlocksBuf = nullptr;
+            }
+            else
+            {
+                void* blocksBuf;
+                e = allocator.Allocate(static_cast<DWORD>(blockCount * blockSize), &blocksBuf);
+                if (e == noErr)
+                {
+                    BYTE* blocks = static_cast<BYTE*>(blocksBuf);
+
+                    for (int i = 0; i < blockCount; i++)
+                    {
+                        memcpy(blocks + (i * blockSize), uniqueBlocks + (blockIndex[i] * blockSize), blockSize);
+                    }
+
+                    *compressedData = blocksBuf;
+                }
+            }
+
+            if (e == noErr)
+            {
+                *compressedLength = blockCount * blockSize;
+            }
+        }
+    }
+
+    if (uniqueBlocksBuf != nullptr)
+    {
+        allocator.Free(uniqueBlocksBuf);
+    }
+    if (uniqueBuf != nullptr)
+    {
+        allocator.Free(uniqueBuf);
+    }
+    if (blockIndexBuf != nullptr)
+    {
+        allocator.Free(blockIndexBuf);
+    }
+    if (tableBuf != nullptr)
+    {
+        allocator.Free(tableBuf);
+    }
+
+    return e;
+}
+
+// Packs a row of 8-bit pixels into one of the 16-bit formats, colBytes must be at least 3.
+static void PackSixteenBitRow(const FshBmpType code, const BYTE* src, const int colBytes, const int width, UINT16* dst)
+{
+    switch (code)
+    {
+    case SixteenBit:
+        PackRow<Pack565>(src, colBytes, width, dst);
+        break;
+    case SixteenBitAlpha:
+        PackRow<Pack1555>(src, colBytes, width, dst);
+        break;
+    case SixteenBit4x4:
+        PackRow<Pack4444>(src, colBytes, width, dst);
+        break;
+    default:
+        break;
+    }
+}
+
+// Encodes the image into a buffer from the allocator that the caller must free.
+static OSErr EncodeFshImageData(FshAllocator& allocator,
+                                const FshEncodeOptions& options,
+                                const void* data,
+                                const int width,
+                                const int height,
+                                const int rowBytes,
+                                const int colBytes,
+                                const int planes,
+                                void** encodedData,
+                                int* encodedLength,
+                                FshDxtBlockCounts* blockCounts)
+{
+    *encodedData = nullptr;
+    *encodedLength = 0;
+
+    const FshBmpType fshType = options.code;
+
+    if (fshType == DXT1 || fshType == DXT3)
+    {
+        const DxtSourceImage source = { static_cast<const BYTE*>(data), width, height, rowBytes, colBytes, planes };
+
+        return CompressDxtImage(allocator, options, source, encodedData, encodedLength, blockCounts);
+    }
+
+    OSErr e = noErr;
+
+    void* outBuf = nullptr;
+
+    int dataLength = 0;
+
+    if (fshType == TwentyFourBit || fshType == ThirtyTwoBit)
+    {
+        // The 24-bit and 32-bit formats are stored in BGR(A) order.
+        const int outRowBytes = width * planes;
+        const int outColBytes = planes;
+        dataLength = outRowBytes * height;
+
+        if (options.mipCount > 0 && !options.mipPacked)
+        {
+            // Pad the length to a multiple of 16 bytes.
+            dataLength = (dataLength + 15) & ~15;
+        }
+
+        e = allocator.Allocate(static_cast<DWORD>(dataLength), &outBuf);
+        if (e == noErr)
+        {
+            const BYTE* dataPtr = static_cast<const BYTE*>(data);
+            BYTE* outPtr = static_cast<BYTE*>(outBuf);
+
+            for (int y = 0; y < height; y++)
+            {
+                const BYTE* in = dataPtr + (y * rowBytes);
+                BYTE* out = outPtr + (y * outRowBytes);
+                for (int x = 0; x < width; x++)
+                {
+                    if (planes == 4)
+                    {
+                        if (in[3] == 0)
+                        {
+                            // Set the color of any transparent pixels to black.
+                            out[0] = 0;
+                            out[1] = 0;
+                            out[2] = 0;
+                        }
+                        else
+                        {
+                            out[0] = in[2];
+                            out[1] = in[1];
+                            out[2] = in[0];
+                        }
+
+                        out[3] = in[3];
+                    }
+                    else
+                    {
+                        out[0] = in[2];
+                        out[1] = in[1];
+                        out[2] = in[0];
+                    }
+
+                    in += colBytes;
+                    out += outColBytes;
+                }
+            }
+
+            ZeroMemory(outPtr + (outRowBytes * height), dataLength - (outRowBytes * height));
+        }
+    }
+
+    if (e == noErr)
+    {
+        if (fshType == TwentyFourBit || fshType == ThirtyTwoBit)
+        {
+            *encodedData = outBuf;
+            *encodedLength = dataLength;
+            outBuf = nullptr;
+        }
+        else
+        {
+            dataLength = (width * height) * 2;
+
+            e = allocator.Allocate(static_cast<DWORD>(dataLength), &outBuf);
+            if (e == noErr)
+            {
+                const BYTE* ptr = static_cast<const BYTE*>(data);
+                UINT16* sPtr = static_cast<UINT16*>(outBuf);
+
+                for (int y = 0; y < height; y++)
+                {
+                    PackSixteenBitRow(fshType, ptr + (y * rowBytes), colBytes, width, sPtr + (y * width));
+                }
+
+                *encodedData = outBuf;
+                *encodedLength = dataLength;
+                outBuf = nullptr;
+            }
+        }
+    }
+
+    if (outBuf != nullptr)
+    {
+        allocator.Free(outBuf);
+    }
+
+    return e;
+}
+
+OSErr EncodeFshImage(FshAllocator& allocator,
+                     HANDLE file,
+                     const FshEncodeOptions& options,
+                     const void* data,
+                     const int width,
+                     const int height,
+                     const int rowBytes,
+                     const int colBytes,
+                     const int planes,
+                     FshDxtBlockCounts* blockCounts)
+{
+    void* encodedData;
+    int encodedLength;
+
+    OSErr e = EncodeFshImageData(allocator, options, data, width, height, rowBytes, colBytes, planes, &encodedData, &encodedLength, blockCounts);
+
+    if (e == noErr)
+    {
+        e = WriteFshImageData(file, encodedData, encodedLength);
+
+        allocator.Free(encodedData);
+    }
+
+    return e;
+}
+
+// The FSH format supports a maximum of 15 mipmaps.
+static const int MaxMipCount = 15;
+// The number of encoded mipmaps that can wait for the writer before the encoder blocks.
+static const int MaxQueuedMipLevels = 2;
+
+typedef std::chrono::steady_clock MipChainClock;
+
+static double GetElapsedMilliseconds(const MipChainClock::time_point& start)
+{
+    return std::chrono::duration<double, std::milli>(MipChainClock::now() - start).count();
+}
+
+// Writes the encoded mipmaps on a separate thread in the order they are queued.
+// The buffers are only freed on the thread that queued them, as the plug-in allocator
+// calls back into the host.
+class MipLevelWriter
+{
+public:
+    explicit MipLevelWriter(HANDLE file) : file(file), queuedCount(0), writtenCount(0), freedCount(0), finished(false), error(noErr), writeTime(0.0)
+    {
+        try
+        {
+            thread = std::thread(&MipLevelWriter::Run, this);
+        }
+        catch (const std::system_error&)
+        {
+            // The mipmaps are written by Queue on the calling thread.
+        }
+    }
+
+    ~MipLevelWriter()
+    {
+        Finish();
+    }
+
+    // Queues the encoded mipmap, waiting while the queue is full.
+    // Returns the first write error, the buffer is owned by the writer in either case.
+    OSErr Queue(void* data, const int length)
+    {
+        if (!thread.joinable())
+        {
+            levels[queuedCount].data = data;
+            levels[queuedCount].length = length;
+            queuedCount++;
+
+            if (error == noErr)
+            {
+                error = WriteLevel(levels[writtenCount]);
+            }
+            writtenCount++;
+
+            return error;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+
+        levelWritten.wait(lock, [this] { return (queuedCount - writtenCount) < MaxQueuedMipLevels; });
+
+        levels[queuedCount].data = data;
+        levels[queuedCount].length = length;
+        queuedCount++;
+
+        levelQueued.notify_one();
+
+        return error;
+    }
+
+    // Frees the buffers of the mipmaps that have been written.
+    void FreeWritten(FshAllocator& allocator)
+    {
+        int count;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            count = writtenCount;
+        }
+
+        for (; freedCount < count; freedCount++)
+        {
+            allocator.Free(levels[freedCount].data);
+        }
+    }
+
+    // Waits until every queued mipmap has been written and returns the first write error.
+    OSErr Finish()
+    {
+        if (thread.joinable())
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                finished = true;
+            }
+
+            levelQueued.notify_one();
+            thread.join();
+        }
+
+        return error;
+    }
+
+    double GetWriteTime() const
+    {
+        return writeTime;
+    }
+
+private:
+    struct EncodedLevel
+    {
+        void* data;
+        int length;
+    };
+
+    OSErr WriteLevel(const EncodedLevel& level)
+    {
+        const MipChainClock::time_point start = MipChainClock::now();
+
+        const OSErr e = WriteFshImageData(file, level.data, level.length);
+
+        writeTime += GetElapsedMilliseconds(start);
+
+        return e;
+    }
+
+    void Run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        for (;;)
+        {
+            levelQueued.wait(lock, [this] { return writtenCount < queuedCount || finished; });
+
+            if (writtenCount == queuedCount)
+            {
+                break;
+            }
+
+            // Once a write has failed the remaining mipmaps are skipped.
+            const EncodedLevel level = levels[writtenCount];
+            const bool skip = error != noErr;
+
+            lock.unlock();
+            OSErr e = noErr;
+
+            if (!skip)
+            {
+                e = WriteLevel(level);
+            }
+            lock.lock();
+
+            if (e != noErr)
+            {
+                error = e;
+            }
+            writtenCount++;
+            levelWritten.notify_one();
+        }
+    }
+
+    HANDLE file;
+    EncodedLevel levels[MaxMipCount];
+    int queuedCount;
+    int writtenCount;
+    // Only used by the thread that queues the mipmaps.
+    int freedCount;
+    bool finished;
+    OSErr error;
+    // Only used by the writer thread until it has been joined.
+    double writeTime;
+
+    std::mutex mutex;
+    std::condition_variable levelQueued;
+    std::condition_variable levelWritten;
+    std::thread thread;
+};
+
+OSErr EncodeFshMipChain(FshAllocator& allocator,
+                        HANDLE file,
+                        const FshEncodeOptions& options,
+                        const void* data,
+                        const int width,
+                        const int height,
+                        const int rowBytes,
+                        const int colBytes,
+                        const int planes,
+                        FshMipChainTimings* timings,
+                        FshDxtBlockCounts* blockCounts)
+{
+    if (options.mipCount < 0 || options.mipCount > MaxMipCount)
+    {
+        return paramErr;
+    }
+
+    const MipChainClock::time_point start = MipChainClock::now();
+    FshMipChainTimings stageTimings = {};
+
+    // All of the mipmaps are kept in a single buffer that is about a third of the image size.
+    int pyramidSize = 0;
+    for (int i = 1; i <= options.mipCount; i++)
+    {
+        pyramidSize += (width >> i) * (height >> i) * colBytes;
+    }
+
+    void* pyramidBuf;
+    OSErr e = allocator.Allocate(static_cast<DWORD>(pyramidSize), &pyramidBuf);
+
+    if (e == noErr)
+    {
+        MipLevelWriter writer(file);
+
+        const BYTE* src = static_cast<const BYTE*>(data);
+        int srcRowBytes = rowBytes;
+        BYTE* dst = static_cast<BYTE*>(pyramidBuf);
+
+        for (int i = 1; i <= options.mipCount; i++)
+        {
+            const int levelWidth = width >> i;
+            const int levelHeight = height >> i;
+            const int levelRowBytes = levelWidth * colBytes;
+
+            MipChainClock::time_point stageStart = MipChainClock::now();
+
+            DownsampleImage(src, levelWidth * 2, levelHeight * 2, srcRowBytes, colBytes, options.mipFilter, dst);
+
+            stageTimings.downsample += GetElapsedMilliseconds(stageStart);
+            stageStart = MipChainClock::now();
+
+            void* encodedData;
+            int encodedLength;
+            e = EncodeFshImageData(allocator, options, dst, levelWidth, levelHeight, levelRowBytes, colBytes, planes, &encodedData, &encodedLength, blockCounts);
+
+            stageTimings.encode += GetElapsedMilliseconds(stageStart);
+
+            if (e == noErr)
+            {
+                e = writer.Queue(encodedData, encodedLength);
+            }
+
+            writer.FreeWritten(allocator);
+
+            if (e != noErr)
+            {
+                break;
+            }
+
+            src = dst;
+            srcRowBytes = levelRowBytes;
+            dst += levelRowBytes * levelHeight;
+        }
+
+        const OSErr writeError = writer.Finish();
+        if (e == noErr)
+        {
+            e = writeError;
+        }
+
+        writer.FreeWritten(allocator);
+        stageTimings.write = writer.GetWriteTime();
+
+        allocator.Free(pyramidBuf);
+    }
+
+    stageTimings.total = GetElapsedMilliseconds(start);
+
+    if (e == noErr)
+    {
+        DebugLog("FshFormat: mipmap chain downsample %.2f ms, encode %.2f ms, write %.2f ms, total %.2f ms.\n",
+                 stageTimings.downsample,
+                 stageTimings.encode,
+                 stageTimings.write,
+                 stageTimings.total);
+    }
+
+    if (timings != nullptr)
+    {
+        *timings = stageTimings;
+    }
+
+    return e;
+}
+
+#if FSHCODEC_USE_SSE2
+// Averages four RGBA pixels from each of the two rows into two output pixels.
+static __m128i BoxFilterPixelPairs(__m128i row0, __m128i row1)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    // Sum the rows in 16 bits, the low half holds source pixels 0 and 1 and the high half pixels 2 and 3.
+    __m128i low = _mm_add_epi16(_mm_unpacklo_epi8(row0, zero), _mm_unpacklo_epi8(row1, zero));
+    __m128i high = _mm_add_epi16(_mm_unpackhi_epi8(row0, zero), _mm_unpackhi_epi8(row1, zero));
+
+    // Add the odd pixel of each pair to the even one.
+    low = _mm_add_epi16(low, _mm_srli_si128(low, 8));
+    high = _mm_add_epi16(high, _mm_srli_si128(high, 8));
+
+    __m128i sum = _mm_unpacklo_epi64(low, high);
+
+    return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+}
+#endif // FSHCODEC_USE_SSE2
+
+static void DownsampleRowBox(const BYTE* row0, const BYTE* row1, const int dstWidth, const int channels, BYTE* out)
+{
+    int x = 0;
+
+#if FSHCODEC_USE_SSE2
+    if (channels == 4)
+    {
+        for (; x + 4 <= dstWidth; x += 4)
+        {
+            __m128i a = BoxFilterPixelPairs(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row0)),
+                                            _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1)));
+            __m128i b = BoxFilterPixelPairs(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + 16)),
+                                            _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + 16)));
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(a, b));
+
+            row0 += 32;
+            row1 += 32;
+            out += 16;
+        }
+    }
+#endif // FSHCODEC_USE_SSE2
+
+    for (; x < dstWidth; x++)
+    {
+        for (int i = 0; i < channels; i++)
+        {
+            out[i] = static_cast<BYTE>((row0[i] + row0[channels + i] + row1[i] + row1[channels + i] + 2) >> 2);
+        }
+
+        row0 += channels * 2;
+        row1 += channels * 2;
+        out += channels;
+    }
+}
+
+// The sRGB transfer tables used by the gamma correct filter, linear light is stored in 12 bits.
+struct SrgbTables
+{
+    UINT16 toLinear[256];
+    BYTE fromLinear[4096];
+
+    SrgbTables()
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            const double c = i / 255.0;
+            const double linear = c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+
+            toLinear[i] = static_cast<UINT16>((linear * 4095.0) + 0.5);
+        }
+
+        for (int i = 0; i < 4096; i++)
+        {
+            const double linear = i / 4095.0;
+            const double c = linear <= 0.0031308 ? linear * 12.92 : (1.055 * pow(linear, 1.0 / 2.4)) - 0.055;
+
+            fromLinear[i] = static_cast<BYTE>((c * 255.0) + 0.5);
+        }
+    }
+};
+
+static const SrgbTables& GetSrgbTables()
+{
+    static const SrgbTables tables;
+
+    return tables;
+}
+
+static void DownsampleRowGammaCorrect(const BYTE* row0, const BYTE* row1, const int dstWidth, const int channels, BYTE* out)
+{
+    const SrgbTables& tables = GetSrgbTables();
+    const int colourChannels = channels < 3 ? channels : 3;
+
+    for (int x = 0; x < dstWidth; x++)
+    {
+        for (int i = 0; i < colourChannels; i++)
+        {
+            const int sum = tables.toLinear[row0[i]] + tables.toLinear[row0[channels + i]] +
+                            tables.toLinear[row1[i]] + tables.toLinear[row1[channels + i]];
+
+            out[i] = tables.fromLinear[(sum + 2) >> 2];
+        }
+
+        for (int i = colourChannels; i < channels; i++)
+        {
+            out[i] = static_cast<BYTE>((row0[i] + row0[channels + i] + row1[i] + row1[channels + i] + 2) >> 2);
+        }
+
+        row0 += channels * 2;
+        row1 += channels * 2;
+        out += channels;
+    }
+}
+
+void DownsampleImage(const BYTE* src, const int width, const int height, const int rowBytes, const int channels, const MipFilter filter, BYTE* dst)
+{
+    const int dstWidth = width / 2;
+    const int dstHeight = height / 2;
+
+    for (int y = 0; y < dstHeight; y++)
+    {
+        const BYTE* row0 = src + ((y * 2) * rowBytes);
+        const BYTE* row1 = row0 + rowBytes;
+        BYTE* out = dst + (y * dstWidth * channels);
+
+        if (filter == MipFilterGammaCorrect)
+        {
+            DownsampleRowGammaCorrect(row0, row1, dstWidth, channels, out);
+        }
+        else
+        {
+            DownsampleRowBox(row0, row1, dstWidth, channels, out);
+        }
+    }
+}
@@ -0,0 +1,117 @@
+/*
+*  This file is part of FshFormat, a file format plug-in for Adobe Photoshop(R)
+*  that loads and saves FSH images.
+*
+*  Copyright (C) 2011, 2012, 2013, 2014, 2015, 2022, 2023 Nicholas Hayes
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+
+#ifndef FSHCODEC_H
+#define FSHCODEC_H
+
+#include "FshIo.h"
+
+enum DxtCompressionQuality
+{
+	// libsquish range fit.
+	DxtQualityFastest = 0,
+	// libsquish cluster fit.
+	DxtQualityNormal = 1,
+	// libsquish iterative cluster fit.
+	DxtQualityBest = 2
+};
+
+enum MipFilter
+{
+	// 2x2 box filter on the stored values.
+	MipFilterBox = 0,
+	// 2x2 box filter on linear light, the colour channels are treated as sRGB.
+	MipFilterGammaCorrect = 1
+};
+
+struct FshEncodeOptions
+{
+	FshBmpType code;
+	// Use libsquish for the DXT formats instead of the FSHTool compressor.
+	bool squishDxt;
+	// The libsquish colour fit, ignored by the FSHTool compressor.
+	DxtCompressionQuality dxtQuality;
+	// Weight the libsquish colour error by the perceived brightness of each channel.
+	bool dxtPerceptualMetric;
+	// The mean squared error per pixel at which the libsquish cluster fits stop searching, 0 to disable.
+	float dxtTargetError;
+	int mipCount;
+	bool mipPacked;
+	MipFilter mipFilter;
+};
+
+// Gets the number of channels in the decoded image, 3 for RGB and 4 for RGBA.
+int GetFshBmpChannelCount(const FshBmpType code);
+// Decodes the image data to tightly packed 8-bit RGB or RGBA pixels.
+void DecodeFshImage(const FshBmpType code, const int width, const int height, const void* data, BYTE* outData);
+// Gets the offset of the image data for the specified row, which must be a multiple of 4 for the DXT formats.
+int GetFshImageRowOffset(const FshBmpType code, const int width, const int row);
+// The number of 4x4 blocks in the DXT images that were encoded, only the unique blocks are compressed.
+// The encoders add to the counts, so one structure can total a whole file.
+struct FshDxtBlockCounts
+{
+	int total;
+	int unique;
+};
+
+// Encodes 8-bit RGB or RGBA pixels and writes the image data at the current position of the file.
+// planes is the number of channels that are encoded, transparent pixels are written as black.
+// blockCounts can be nullptr.
+OSErr EncodeFshImage(FshAllocator& allocator,
+					 HANDLE file,
+					 const FshEncodeOptions& options,
+					 const void* data,
+					 const int width,
+					 const int height,
+					 const int rowBytes,
+					 const int colBytes,
+					 const int planes,
+					 FshDxtBlockCounts* blockCounts);
+// The time spent in each stage of EncodeFshMipChain, in milliseconds.
+struct FshMipChainTimings
+{
+	double downsample;
+	double encode;
+	double write;
+	// The elapsed time, less than the sum of the stages when they overlap.
+	double total;
+};
+
+// Builds each mipmap from the previous level and writes the encoded mipmaps at the current position of the file.
+// The source is the full size image with colBytes interleaved channels. A writer thread writes each mipmap while
+// the next one is downsampled and encoded, timings and blockCounts can be nullptr.
+OSErr EncodeFshMipChain(FshAllocator& allocator,
+						HANDLE file,
+						const FshEncodeOptions& options,
+						const void* data,
+						const int width,
+						const int height,
+						const int rowBytes,
+						const int colBytes,
+						const int planes,
+						FshMipChainTimings* timings,
+						FshDxtBlockCounts* blockCounts);
+// Halves the image size with a 2x2 box filter, the source dimensions must be even.
+// The destination is tightly packed, channel 3 is always filtered as linear alpha.
+void DownsampleImage(const BYTE* src, const int width, const int height, const int rowBytes, const int channels, const MipFilter filter, BYTE* dst);
+
+#endif // !FSHCODEC_H
@@ -168,6 +168,48 @@ resource 'aete' (ResourceID, plugInName " dictionary", purgeable)
 				keyFshWriteComp,
 				typeBoolean,
 				"FshWrite Compression",
+				flagsSingleProperty,
+
+				"qfsCompression",
+				keyQfsCompression,
+				typeBoolean,
+				"QFS Compression",
+				flagsSingleProperty,
+
+				"qfsCompressionLevel",
+				keyQfsCompressionLevel,
+				typeInteger,
+				"QFS Compression Level",
+				flagsSingleProperty,
+
+				"qfsEntryCompression",
+				keyQfsEntryCompression,
+				typeBoolean,
+				"QFS Compress Bitmap",
+				flagsSingleProperty,
+
+				"dxtQuality",
+				keyDxtQuality,
+				typeInteger,
+				"DXT Quality",
+				flagsSingleProperty,
+
+				"dxtPerceptualMetric",
+				keyDxtPerceptualMetric,
+				typeBoolean,
+				"DXT Perceptual Metric",
+				flagsSingleProperty,
+
+				"dxtTargetError",
+				keyDxtTargetError,
+				typeFloat,
+				"DXT Target Error",
+				flagsSingleProperty,
+
+				"mipFilter",
+				keyMipFilter,
+				typeInteger,
+				"Mipmap Filter",
 				flagsSingleProperty
 				/* no properties */
 			},
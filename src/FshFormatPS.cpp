@@ -48,7 +48,9 @@ static OSErr CreateGlobals(FormatRecordPtr pb, intptr_t* data)
 
 static OSErr DoFilterFile(FormatRecordPtr pb)
 {
-    return IsValidFshFile(pb);
+    BufferSuiteAllocator allocator(pb);
+
+    return IsValidFshFile(allocator, reinterpret_cast<HANDLE>(pb->dataFork));
 }
 
 DLLExport MACPASCAL void PluginMain (const short selector, FormatRecordPtr pb, intptr_t* data, short* result)
@@ -71,6 +73,8 @@ DLLExport MACPASCAL void PluginMain (const short selector, FormatRecordPtr pb, i
             ZeroMemory(globals, sizeof(Globals));
             globals->fshCode = DXT1;
             globals->fshWriteCompression = true;
+            globals->qfsCompressionLevel = QFSCompressionNormal;
+            globals->dxtQuality = DxtQualityBest;
         }
         else
         {
@@ -22,7 +22,9 @@
 #ifndef FSHFORMATPS_H
 #define FSHFORMATPS_H
 
+#include "FshCodec.h"
 #include "FshIo.h"
+#include "QFS.h"
 
 struct RevertInfo
 {
@@ -32,6 +34,8 @@ struct RevertInfo
 	char headerDir[4];
 	char entryDir[4];
 	int loadIndex;
+	bool qfsCompressed;
+	bool qfsEntryCompressed;
 };
 
 struct Globals
@@ -40,8 +44,15 @@ struct Globals
 	bool fshWriteCompression;
 	int mipCount;
 	bool mipPacked;
+	MipFilter mipFilter;
 	char headerDir[4];
 	char entryDir[4];
+	bool qfsCompression;
+	bool qfsEntryCompression;
+	QFSCompressionLevel qfsCompressionLevel;
+	DxtCompressionQuality dxtQuality;
+	bool dxtPerceptualMetric;
+	float dxtTargetError;
 };
 
 //-------------------------------------------------------------------------------
@@ -20,180 +20,123 @@
 */
 
 #include "FshIo.h"
+#include "FshArchiveIndex.h"
+#include "DebugLog.h"
 #include "FileIo.h"
 #include "QFS.h"
-#include "resource.h"
+#include <chrono>
+#include <limits.h>
 #include <new>
 #include <memory>
+#include <stddef.h>
+#include <stdio.h>
 
-OSErr CountEntryMipMaps(HANDLE hFile, const FshHeader& header, const FshDirEntry& dir, const FshBmpEntry& entry, int* count, bool* packed)
+// The uncompressed file when it is not QFS compressed.
+static FileMapping fshMapping;
+
+static DWORD GetInMemorySize();
+
+OSErr GetInMemoryFshData(const DWORD offset, const DWORD length, const BYTE** data)
 {
     OSErr e = noErr;
+    *data = nullptr;
 
-    *count = 0;
-    *packed = false;
-    const bool compressed = (entry.code & 0x80) != 0;
-
-    if (!compressed && (entry.misc[3] & 0x0FFF) == 0) // multiscale bitmaps
+    if (qfsBuffer != nullptr || fshMapping.IsOpen())
     {
-        int numScales = (entry.misc[3] >> 12) & 0x0F;
-        if ((entry.width % (1 << numScales)) != 0 || (entry.height % (1 << numScales)) != 0)
+        const DWORD size = GetInMemorySize();
+
+        if (offset > size || length > (size - offset))
         {
-            numScales = 0;
+            e = eofErr;
         }
-
-        if (numScales > 0)
+        else if (qfsBuffer != nullptr)
         {
-            try
-            {
-                FshDirEntry* dirEntries = new FshDirEntry[header.numBmps];
-                for (int i = 0; i < header.numBmps; i++)
-                {
-                    e = ReadFshDir(hFile, i, &dirEntries[i]);
-                    if (e != noErr) break;
-                }
-
-                if (e == noErr)
-                {
-                    UINT32 nextOffset = static_cast<UINT32>(header.size);
-
-                    for (int i = 0; i < header.numBmps; i++)
-                    {
-                        if (dirEntries[i].offset > dir.offset && static_cast<UINT32>(dirEntries[i].offset) < nextOffset)
-                        {
-                            nextOffset = dirEntries[i].offset;
-                        }
-                    }
-
-                    const FshBmpType code = static_cast<FshBmpType>(entry.code & 0x7F);
-
-                    UINT32 mbpLen = 0;
-                    UINT32 mbpPadLen = 0;
-
-                    for (int i = 0; i <= numScales; i++)
-                    {
-                        const int width = entry.width >> i;
-                        const int height = entry.height >> i;
-
-                        UINT32 dataLength = 0;
-
-                        switch (code)
-                        {
-                        case DXT1:
-                            // DXT1 images must be padded to a multiple of four.
-                            dataLength = ((((width + 3) & ~3) * ((height + 3) & ~3)) / 2);
-                            break;
-                        case DXT3:
-                            dataLength = (width * height);
-                            break;
-                        case ThirtyTwoBit:
-                            dataLength = (width * height * 4);
-                            break;
-                        case TwentyFourBit:
-                            dataLength = (width * height * 3);
-                            break;
-                        case SixteenBit:
-                        case SixteenBitAlpha:
-                        case SixteenBit4x4:
-                            dataLength = (width * height * 2);
-                            break;
-                        }
-
-                        mbpLen += dataLength;
-                        mbpPadLen += dataLength;
-
-                        // DXT1 mipmaps smaller than 4x4 are also padded
-                        int padLength = ((16 - static_cast<INT64>(mbpLen)) & 15);
-                        if (padLength > 0)
-                        {
-                            mbpLen += padLength;
-                            if (i == numScales)
-                            {
-                                mbpPadLen += padLength;
-                            }
-                        }
-                    }
-
-                    const UINT32 entryLength = static_cast<UINT32>(entry.code >> 8);
-
-                    if (entryLength != 0 && entryLength != (mbpLen + sizeof(FshBmpEntry)) ||
-                        entryLength == 0 && (mbpLen + dir.offset + sizeof(FshBmpEntry)) != nextOffset)
-                    {
-                        *packed = true;
-                        if (entryLength != 0 && entryLength != (mbpPadLen + sizeof(FshBmpEntry)) ||
-                            entryLength == 0 && (mbpPadLen + dir.offset + sizeof(FshBmpEntry)) != nextOffset)
-                        {
-                            numScales = 0;
-                        }
-                    }
-
-                    *count = numScales;
-                }
+            e = DecompressFshRange(offset + length);
 
-                delete[] dirEntries;
-            }
-            catch(std::bad_alloc)
+            if (e == noErr)
             {
-                e = memFullErr;
+                *data = qfsBuffer + offset;
             }
         }
+        else
+        {
+            *data = fshMapping.GetData() + offset;
+        }
     }
 
     return e;
 }
 
-OSErr CheckFshBmpTypes(HANDLE file, const FshHeader& header)
+OSErr GetEntryUncompressedSize(HANDLE hFile, const FshDirEntry& dir, int* uncompressedSize)
 {
     OSErr e = noErr;
+    const DWORD offset = dir.offset + sizeof(FshBmpEntry);
 
-    if (header.numBmps >= 1)
+    if (qfsBuffer != nullptr || fshMapping.IsOpen())
     {
-        for (int i = 0; i < header.numBmps; i++)
-        {
-            FshDirEntry dir;
-            FshBmpEntry entry;
-
-            e = ReadFshDir(file, i, &dir);
+        // The QFS header is at most 14 bytes long and must be followed by at least one byte.
+        const DWORD size = GetInMemorySize();
+        const DWORD available = offset < size ? size - offset : 0;
+        const DWORD length = available < 15 ? available : 15;
+        const BYTE* data;
 
-            if (e != noErr) break;
+        e = GetInMemoryFshData(offset, length, &data);
 
-            e = ReadFshEntryDir(file, dir, &entry);
-
-            if (e != noErr) break;
+        if (e == noErr)
+        {
+            e = GetUncompressedSize(data, length, uncompressedSize);
+        }
+    }
+    else
+    {
+        bool compressed = false;
 
-            const FshBmpType code = static_cast<FshBmpType>(entry.code & 0x7F);
+        e = IsQFSCompressed(hFile, offset, &compressed);
 
-            if (code != DXT1 &&
-                code != DXT3 &&
-                code != ThirtyTwoBit &&
-                code != TwentyFourBit &&
-                code != SixteenBit &&
-                code != SixteenBitAlpha &&
-                code != SixteenBit4x4)
+        if (e == noErr)
+        {
+            if (compressed)
             {
-                e = formatCannotRead;
-                break;
+                e = GetUncompressedSize(hFile, offset, uncompressedSize);
+            }
+            else
+            {
+                e = formatCannotRead; // Unknown compression format
             }
         }
     }
-    else
-    {
-        e = formatCannotRead;
-    }
 
     return e;
 }
 
-OSErr GetFshBmpInfo(HANDLE file, const int index, FshBmpEntry* entry)
+bool IsSupportedFshBmpType(const FshBmpType code)
 {
-    OSErr e = noErr;
+    return code == DXT1 ||
+           code == DXT3 ||
+           code == ThirtyTwoBit ||
+           code == TwentyFourBit ||
+           code == SixteenBit ||
+           code == SixteenBitAlpha ||
+           code == SixteenBit4x4;
+}
 
-    FshDirEntry dir;
-    e = ReadFshDir(file, index, &dir);
+OSErr CheckFshBmpTypes(FshArchiveIndex& index)
+{
+    OSErr e = noErr;
 
-    if (e == noErr)
+    for (int i = 0; i < index.GetEntryCount(); i++)
     {
-        e = ReadFshEntryDir(file, dir, entry);
+        FshBmpEntry entry;
+
+        e = index.GetBmpEntry(i, &entry);
+
+        if (e != noErr) break;
+
+        if (!IsSupportedFshBmpType(static_cast<FshBmpType>(entry.code & 0x7F)))
+        {
+            e = formatCannotRead;
+            break;
+        }
     }
 
     return e;
@@ -220,7 +163,92 @@ int GetImageDataSize(const int width, const int height, const FshBmpType format)
     return 0; // unsupported format
 }
 
-OSErr DecompressFsh(FormatRecordPtr pb, HANDLE file)
+// The size of the blocks that are read from the file and passed to the QFS decoder.
+static const DWORD DecompressReadBlockSize = 65536;
+
+// The state used to decompress a QFS compressed file on demand.
+struct QfsDecompressState
+{
+    QFSStreamDecoder* decoder;
+    HANDLE file;
+    BYTE* readBlock;
+    DWORD readBlockLength;
+    DWORD readBlockIndex;
+    // The file can be read by other code between calls, so the next block is read from this offset.
+    DWORD fileOffset;
+    DWORD fileRemaining;
+    DWORD decompressedLength;
+};
+
+static QfsDecompressState qfsState;
+
+// Decodes the file until at least endOffset bytes of qfsBuffer are available, or until the header has been read
+// when qfsBuffer has not been allocated yet.
+static OSErr DecompressQfsBlocks(const DWORD endOffset)
+{
+    OSErr e = noErr;
+    QFSStreamDecoder* decoder = qfsState.decoder;
+
+    while (e == noErr && !decoder->IsFinished() && (qfsBuffer == nullptr ? !decoder->HasHeader() : qfsState.decompressedLength < endOffset))
+    {
+        if (qfsState.readBlockIndex == qfsState.readBlockLength)
+        {
+            if (qfsState.fileRemaining == 0)
+            {
+                break;
+            }
+
+            const DWORD blockSize = qfsState.fileRemaining < DecompressReadBlockSize ? qfsState.fileRemaining : DecompressReadBlockSize;
+
+            e = SetFilePosition(qfsState.file, FILE_BEGIN, static_cast<LONG>(qfsState.fileOffset));
+
+            if (e == noErr)
+            {
+                e = ReadBytes(qfsState.file, qfsState.readBlock, blockSize);
+            }
+
+            if (e == noErr)
+            {
+                qfsState.fileOffset += blockSize;
+                qfsState.fileRemaining -= blockSize;
+                qfsState.readBlockLength = blockSize;
+                qfsState.readBlockIndex = 0;
+            }
+        }
+
+        if (e == noErr)
+        {
+            DWORD consumed;
+            e = decoder->Feed(qfsState.readBlock + qfsState.readBlockIndex, qfsState.readBlockLength - qfsState.readBlockIndex, &consumed);
+            qfsState.readBlockIndex += consumed;
+
+            if (e == noErr && qfsBuffer != nullptr)
+            {
+                qfsState.decompressedLength += decoder->Drain(qfsBuffer + qfsState.decompressedLength, decoder->GetUncompressedSize() - qfsState.decompressedLength);
+            }
+        }
+    }
+
+    if (e == noErr && qfsBuffer != nullptr)
+    {
+        qfsState.decompressedLength += decoder->Drain(qfsBuffer + qfsState.decompressedLength, decoder->GetUncompressedSize() - qfsState.decompressedLength);
+
+        if (decoder->IsFinished() && qfsState.decompressedLength != decoder->GetUncompressedSize())
+        {
+            // The end of stream op code was reached before all of the data that the header declares.
+            e = formatCannotRead;
+        }
+        else if (qfsState.decompressedLength < endOffset)
+        {
+            // The file ended before the requested range was produced.
+            e = eofErr;
+        }
+    }
+
+    return e;
+}
+
+OSErr DecompressFsh(FshAllocator& allocator, HANDLE file)
 {
     bool compressed = false;
 
@@ -246,35 +274,55 @@ OSErr DecompressFsh(FormatRecordPtr pb, HANDLE file)
 
                 if (e == noErr)
                 {
-                    BufferID tempBuffer;
+                    void* readBlock;
+                    e = allocator.Allocate(DecompressReadBlockSize, &readBlock);
 
-                    e = pb->bufferProcs->allocateProc(static_cast<int32>(size), &tempBuffer);
                     if (e == noErr)
                     {
-                        BYTE* fshBytes = reinterpret_cast<BYTE*>(pb->bufferProcs->lockProc(tempBuffer, FALSE));
-                        e = ReadBytes(file, fshBytes, static_cast<DWORD>(size));
+                        qfsState.readBlock = static_cast<BYTE*>(readBlock);
+                        qfsState.file = file;
+                        qfsState.readBlockLength = 0;
+                        qfsState.readBlockIndex = 0;
+                        qfsState.fileOffset = 0;
+                        qfsState.fileRemaining = static_cast<DWORD>(size);
+                        qfsState.decompressedLength = 0;
+
+                        try
+                        {
+                            qfsState.decoder = new QFSStreamDecoder();
+                        }
+                        catch (const std::bad_alloc&)
+                        {
+                            e = memFullErr;
+                        }
 
                         if (e == noErr)
                         {
-                            int uncompressedSize;
-
-                            e = GetUncompressedSize(fshBytes, static_cast<DWORD>(size), &uncompressedSize);
+                            e = DecompressQfsBlocks(0);
 
                             if (e == noErr)
                             {
-                                e = pb->bufferProcs->allocateProc(static_cast<int32>(uncompressedSize), &qfsBufferID);
-
-                                if (e == noErr)
+                                if (qfsState.decoder->HasHeader())
                                 {
-                                    qfsBuffer = reinterpret_cast<BYTE*>(pb->bufferProcs->lockProc(qfsBufferID, FALSE));
+                                    void* buffer;
+                                    e = allocator.Allocate(qfsState.decoder->GetUncompressedSize(), &buffer);
 
-                                    e = QFSDecompress(fshBytes, static_cast<DWORD>(size), qfsBuffer, uncompressedSize);
+                                    if (e == noErr)
+                                    {
+                                        qfsBuffer = static_cast<BYTE*>(buffer);
+                                    }
+                                }
+                                else
+                                {
+                                    e = formatCannotRead; // Truncated or invalid data.
                                 }
                             }
                         }
 
-                        pb->bufferProcs->unlockProc(tempBuffer);
-                        pb->bufferProcs->freeProc(tempBuffer);
+                        if (e != noErr)
+                        {
+                            FreeDecompressedFsh(allocator);
+                        }
                     }
                 }
             }
@@ -284,6 +332,64 @@ OSErr DecompressFsh(FormatRecordPtr pb, HANDLE file)
     return e;
 }
 
+OSErr DecompressFshRange(const DWORD endOffset)
+{
+    OSErr e = noErr;
+
+    if (qfsBuffer != nullptr && qfsState.decompressedLength < endOffset)
+    {
+        e = DecompressQfsBlocks(endOffset);
+    }
+
+    return e;
+}
+
+bool IsFshRangeDecompressed(const DWORD endOffset)
+{
+    return qfsBuffer == nullptr || qfsState.decompressedLength >= endOffset;
+}
+
+static DWORD GetInMemorySize()
+{
+    if (qfsBuffer != nullptr)
+    {
+        return qfsState.decoder->GetUncompressedSize();
+    }
+
+    return fshMapping.GetSize();
+}
+
+OSErr MapFsh(HANDLE file)
+{
+    return fshMapping.Open(file);
+}
+
+void UnmapFsh()
+{
+    fshMapping.Close();
+}
+
+void FreeDecompressedFsh(FshAllocator& allocator)
+{
+    if (qfsState.decoder != nullptr)
+    {
+        delete qfsState.decoder;
+        qfsState.decoder = nullptr;
+    }
+
+    if (qfsState.readBlock != nullptr)
+    {
+        allocator.Free(qfsState.readBlock);
+        qfsState.readBlock = nullptr;
+    }
+
+    if (qfsBuffer != nullptr)
+    {
+        allocator.Free(qfsBuffer);
+        qfsBuffer = nullptr;
+    }
+}
+
 static bool CheckIdentifier (const char (&identifier)[4])
 {
     return identifier[0] == 'S' &&
@@ -292,34 +398,37 @@ static bool CheckIdentifier (const char (&identifier)[4])
            identifier[3] == 'I';
 }
 
-OSErr ReadFshHeader(HANDLE file, FshHeader* head)
+OSErr ReadFshHeader(BufferedFileReader& file, FshHeader* head)
 {
     ZeroMemory(head, sizeof(FshHeader));
     OSErr e = noErr;
 
-    if (qfsBuffer != nullptr)
+    const BYTE* data;
+    e = GetInMemoryFshData(0, sizeof(FshHeader), &data);
+
+    if (e == noErr && data != nullptr)
     {
-        *head = *reinterpret_cast<FshHeader*>(qfsBuffer);
+        *head = *reinterpret_cast<const FshHeader*>(data);
     }
-    else
+    else if (e == noErr)
     {
-        e = SetFilePosition(file, FILE_BEGIN, 0);
+        e = file.SetPosition(0);
 
         if (e == noErr)
         {
-            e = ReadBytes(file, head->SHPI, 4);
+            e = file.ReadBytes(head->SHPI, 4);
 
             if (e == noErr)
             {
-                e = ReadInt32(file, &head->size);
+                e = file.ReadInt32(&head->size);
 
                 if (e == noErr)
                 {
-                    e = ReadInt32(file, &head->numBmps);
+                    e = file.ReadInt32(&head->numBmps);
 
                     if (e == noErr)
                     {
-                        e = ReadBytes(file, head->dirID, 4);
+                        e = file.ReadBytes(head->dirID, 4);
                     }
                 }
             }
@@ -334,28 +443,31 @@ OSErr ReadFshHeader(HANDLE file, FshHeader* head)
     return e;
 }
 
-OSErr ReadFshDir(HANDLE file, const int index, FshDirEntry* dir)
+OSErr ReadFshDir(BufferedFileReader& file, const int index, FshDirEntry* dir)
 {
     OSErr e = noErr;
 
     ZeroMemory(dir, sizeof(FshDirEntry));
     int offset = sizeof(FshHeader) + index * sizeof(FshDirEntry);
 
-    if (qfsBuffer != nullptr)
+    const BYTE* data;
+    e = GetInMemoryFshData(offset, sizeof(FshDirEntry), &data);
+
+    if (e == noErr && data != nullptr)
     {
-        *dir = *reinterpret_cast<FshDirEntry*>(qfsBuffer + offset);
+        *dir = *reinterpret_cast<const FshDirEntry*>(data);
     }
-    else
+    else if (e == noErr)
     {
-        e = SetFilePosition(file, FILE_BEGIN, offset);
+        e = file.SetPosition(offset);
 
         if (e == noErr)
         {
-            e = ReadBytes(file, dir->name, 4);
+            e = file.ReadBytes(dir->name, 4);
 
             if (e == noErr)
             {
-                e = ReadInt32(file, &dir->offset);
+                e = file.ReadInt32(&dir->offset);
             }
         }
     }
@@ -363,36 +475,39 @@ OSErr ReadFshDir(HANDLE file, const int index, FshDirEntry* dir)
     return e;
 }
 
-OSErr ReadFshEntryDir(HANDLE file, const FshDirEntry& dir, FshBmpEntry* entry)
+OSErr ReadFshEntryDir(BufferedFileReader& file, const FshDirEntry& dir, FshBmpEntry* entry)
 {
     ZeroMemory(entry, sizeof(FshBmpEntry));
     OSErr e = noErr;
 
-    if (qfsBuffer != nullptr)
+    const BYTE* data;
+    e = GetInMemoryFshData(dir.offset, sizeof(FshBmpEntry), &data);
+
+    if (e == noErr && data != nullptr)
     {
-        *entry = *reinterpret_cast<FshBmpEntry*>(qfsBuffer + dir.offset);
+        memcpy(entry, data, sizeof(FshBmpEntry));
     }
-    else
+    else if (e == noErr)
     {
-        e = SetFilePosition(file, FILE_BEGIN, dir.offset);
+        e = file.SetPosition(dir.offset);
 
         if (e == noErr)
         {
-            e = ReadInt32(file, &entry->code);
+            e = file.ReadInt32(&entry->code);
 
             if (e == noErr)
             {
-                e = ReadUInt16(file, &entry->width);
+                e = file.ReadUInt16(&entry->width);
 
                 if (e == noErr)
                 {
-                    e = ReadUInt16(file, &entry->height);
+                    e = file.ReadUInt16(&entry->height);
 
                     if (e == noErr)
                     {
                         for (int i = 0; i < 4; i++)
                         {
-                            e = ReadUInt16(file, &entry->misc[i]);
+                            e = file.ReadUInt16(&entry->misc[i]);
 
                             if (e != noErr) break;
                         }
@@ -405,82 +520,47 @@ OSErr ReadFshEntryDir(HANDLE file, const FshDirEntry& dir, FshBmpEntry* entry)
     return e;
 }
 
-static OSErr DecompressEntry(FormatRecordPtr pb,
-                             const FshHeader& header,
-                             const FshDirEntry& dir,
+static OSErr DecompressEntry(FshAllocator& allocator,
+                             const FshArchiveIndex& index,
+                             const int entryIndex,
                              const FshBmpEntry& entry,
                              void* outData,
                              const DWORD outLength)
 {
     OSErr e = noErr;
-    const int imageStartOffset = dir.offset + sizeof(FshBmpEntry);
+    const int imageStartOffset = index.GetDirEntry(entryIndex).offset + sizeof(FshBmpEntry);
 
-    HANDLE hFile = reinterpret_cast<HANDLE>(pb->dataFork);
+    HANDLE hFile = index.GetFile();
 
     int size = 0;
 
     int entrySize = entry.code >> 8;
     if (entrySize > 0)
     {
-        size = entrySize;
+        // The entry size includes the FshBmpEntry header.
+        size = entrySize - sizeof(FshBmpEntry);
     }
     else
     {
-        if (header.numBmps == 1)
-        {
-            size = header.size - imageStartOffset;
-        }
-        else
-        {
-            try
-            {
-                // Calculate the next offset to get the size.
-                FshDirEntry* dirEntries = new FshDirEntry[header.numBmps];
-                for (int j = 0; j < header.numBmps; j++)
-                {
-                    e = ReadFshDir(hFile, j, &dirEntries[j]);
-                    if (e != noErr)	break;
-                }
-
-                if (e == noErr)
-                {
-                    int nextOffset = header.size;
-
-                    for (int j = 0; j < header.numBmps; j++)
-                    {
-                        if ((dirEntries[j].offset > dir.offset) && (dirEntries[j].offset < nextOffset))
-                        {
-                            nextOffset = dirEntries[j].offset;
-                        }
-                    }
-
-                    size = nextOffset - imageStartOffset;
-                }
-
-                delete[] dirEntries;
-            }
-            catch (std::bad_alloc)
-            {
-                e = memFullErr;
-            }
-        }
+        size = index.GetNextOffset(entryIndex) - imageStartOffset;
     }
 
+    const BYTE* data;
+    e = GetInMemoryFshData(imageStartOffset, static_cast<DWORD>(size), &data);
+
     if (e == noErr)
     {
-        if (qfsBuffer != nullptr)
+        if (data != nullptr)
         {
-            e = QFSDecompress(qfsBuffer + imageStartOffset, static_cast<DWORD>(size), reinterpret_cast<BYTE*>(outData), outLength);
+            e = QFSDecompress(data, static_cast<DWORD>(size), reinterpret_cast<BYTE*>(outData), outLength);
         }
         else
         {
-            BufferID temp;
-            e = pb->bufferProcs->allocateProc(static_cast<int32>(size), &temp);
+            void* compressedData;
+            e = allocator.Allocate(static_cast<DWORD>(size), &compressedData);
 
             if (e == noErr)
             {
-                Ptr compressedData = pb->bufferProcs->lockProc(temp, FALSE);
-
                 e = SetFilePosition(hFile, FILE_BEGIN, imageStartOffset);
 
                 if (e == noErr)
@@ -489,12 +569,11 @@ static OSErr DecompressEntry(FormatRecordPtr pb,
 
                     if (e == noErr)
                     {
-                        e = QFSDecompress(reinterpret_cast<BYTE*>(compressedData), size, reinterpret_cast<BYTE*>(outData), outLength);
+                        e = QFSDecompress(static_cast<BYTE*>(compressedData), size, reinterpret_cast<BYTE*>(outData), outLength);
                     }
                 }
 
-                pb->bufferProcs->unlockProc(temp);
-                pb->bufferProcs->freeProc(temp);
+                allocator.Free(compressedData);
             }
         }
     }
@@ -502,29 +581,32 @@ static OSErr DecompressEntry(FormatRecordPtr pb,
     return e;
 }
 
-OSErr ReadFshImageData(FormatRecordPtr pb,
-                       const FshHeader& header,
-                       const FshDirEntry& dir,
+OSErr ReadFshImageData(FshAllocator& allocator,
+                       const FshArchiveIndex& index,
+                       const int entryIndex,
                        const FshBmpEntry& entry,
                        void* outData,
                        const DWORD outLength)
 {
     OSErr e = noErr;
+    const FshDirEntry& dir = index.GetDirEntry(entryIndex);
 
     if ((entry.code & 0x80) != 0)
     {
-        e = DecompressEntry(pb, header, dir, entry, outData, outLength);
+        e = DecompressEntry(allocator, index, entryIndex, entry, outData, outLength);
     }
     else
     {
-        if (qfsBuffer != nullptr)
+        const BYTE* data;
+        e = GetInMemoryFshData(dir.offset + sizeof(FshBmpEntry), outLength, &data);
+
+        if (e == noErr && data != nullptr)
         {
-            const void* src = qfsBuffer + (dir.offset + sizeof(FshBmpEntry));
-            memcpy(outData, src, outLength);
+            memcpy(outData, data, outLength);
         }
-        else
+        else if (e == noErr)
         {
-            HANDLE file = reinterpret_cast<HANDLE>(pb->dataFork);
+            HANDLE file = index.GetFile();
             e = SetFilePosition(file, FILE_BEGIN, dir.offset + sizeof(FshBmpEntry));
 
             if (e == noErr)
@@ -537,24 +619,68 @@ OSErr ReadFshImageData(FormatRecordPtr pb,
     return e;
 }
 
-OSErr WriteFshHeader(HANDLE file, const FshHeader& header)
+OSErr GetFshImageDataSize(const FshArchiveIndex& index, const int entryIndex, const FshBmpEntry& entry, int* dataSize)
 {
     OSErr e = noErr;
 
-    e = SetFilePosition(file, FILE_BEGIN, 0);
+    if ((entry.code & 0x80) != 0)
+    {
+        e = GetEntryUncompressedSize(index.GetFile(), index.GetDirEntry(entryIndex), dataSize);
+    }
+    else
+    {
+        *dataSize = GetImageDataSize(entry.width, entry.height, static_cast<FshBmpType>(entry.code & 0x7F));
+
+        if (*dataSize == 0)
+        {
+            e = formatCannotRead; // Unsupported image format
+        }
+    }
+
+    return e;
+}
+
+OSErr GetFshImageDataView(const FshArchiveIndex& index,
+                          const int entryIndex,
+                          const FshBmpEntry& entry,
+                          const DWORD length,
+                          const void** view)
+{
+    OSErr e = noErr;
+    *view = nullptr;
+
+    if ((entry.code & 0x80) == 0)
+    {
+        const BYTE* data;
+        e = GetInMemoryFshData(index.GetDirEntry(entryIndex).offset + sizeof(FshBmpEntry), length, &data);
+
+        if (e == noErr)
+        {
+            *view = data;
+        }
+    }
+
+    return e;
+}
+
+OSErr WriteFshHeader(BufferedFileWriter& file, const FshHeader& header)
+{
+    OSErr e = noErr;
+
+    e = file.SetPosition(0);
 
     if (e == noErr)
     {
-        e = WriteBytes(file, header.SHPI, 4);
+        e = file.WriteBytes(header.SHPI, 4);
         if (e == noErr)
         {
-            e = WriteInt32(file, header.size);
+            e = file.WriteInt32(header.size);
             if (e == noErr)
             {
-                e = WriteInt32(file, header.numBmps);
+                e = file.WriteInt32(header.numBmps);
                 if (e == noErr)
                 {
-                    e = WriteBytes(file, header.dirID, 4);
+                    e = file.WriteBytes(header.dirID, 4);
                 }
             }
         }
@@ -563,38 +689,38 @@ OSErr WriteFshHeader(HANDLE file, const FshHeader& header)
     return e;
 }
 
-OSErr WriteFshDir(HANDLE file, const FshDirEntry& dir)
+OSErr WriteFshDir(BufferedFileWriter& file, const FshDirEntry& dir)
 {
     OSErr e = noErr;
 
-    e = WriteBytes(file, dir.name, 4);
+    e = file.WriteBytes(dir.name, 4);
     if (e == noErr)
     {
-        e = WriteInt32(file, dir.offset);
+        e = file.WriteInt32(dir.offset);
     }
 
     return e;
 }
 
-OSErr WriteFshEntryDir(HANDLE file, const FshDirEntry& dir, const FshBmpEntry& entry)
+OSErr WriteFshEntryDir(BufferedFileWriter& file, const FshDirEntry& dir, const FshBmpEntry& entry)
 {
     OSErr e = noErr;
 
-    e = SetFilePosition(file, FILE_BEGIN, dir.offset);
+    e = file.SetPosition(dir.offset);
     if (e == noErr)
     {
-        e = WriteInt32(file, entry.code);
+        e = file.WriteInt32(entry.code);
         if (e == noErr)
         {
-            e = WriteUInt16(file, entry.width);
+            e = file.WriteUInt16(entry.width);
             if (e == noErr)
             {
-                e = WriteUInt16(file, entry.height);
+                e = file.WriteUInt16(entry.height);
                 if (e == noErr)
                 {
                     for (int i = 0; i < 4; i++)
                     {
-                        e = WriteUInt16(file, entry.misc[i]);
+                        e = file.WriteUInt16(entry.misc[i]);
 
                         if (e != noErr) break;
                     }
@@ -611,29 +737,228 @@ OSErr WriteFshImageData(HANDLE file, const void* inData, const int length)
     return WriteBytes(file, inData, length);
 }
 
-OSErr IsValidFshFile(FormatRecordPtr pb)
+OSErr UpdateFshEntryHeader(HANDLE file, const FshDirEntry& dir, const FshBmpEntry& entry, const int mipCount)
+{
+    DWORD newOffset;
+    OSErr e = GetFilePosition(file, &newOffset);
+
+    if (e == noErr)
+    {
+        e = SetFilePosition(file, FILE_BEGIN, dir.offset);
+        if (e == noErr)
+        {
+            DWORD entrySize = newOffset - dir.offset;
+
+            FshBmpEntry newEntry;
+            ZeroMemory(&newEntry, sizeof(FshBmpEntry));
+            newEntry.code = (entrySize << 8) | (entry.code & 0x7f);
+            newEntry.width = entry.width;
+            newEntry.height = entry.height;
+            for (int i = 0; i < 4; i++)
+            {
+                newEntry.misc[i] = entry.misc[i];
+            }
+
+            newEntry.misc[3] = static_cast<UINT16>(mipCount << 12);
+
+            BufferedFileWriter writer(file);
+
+            e = WriteFshEntryDir(writer, dir, newEntry);
+
+            if (e == noErr)
+            {
+                e = writer.Flush();
+            }
+        }
+    }
+
+    return e;
+}
+
+OSErr WriteFshFileLength(HANDLE file)
 {
     OSErr e = noErr;
-    HANDLE hFile = reinterpret_cast<HANDLE>(pb->dataFork);
+    INT64 fileSize;
 
-    e = DecompressFsh(pb, hFile);
+    // Update the header with the new file size.
+    e = GetFileSize(file, &fileSize);
+    if (e == noErr)
+    {
+        e = SetFilePosition(file, FILE_BEGIN, static_cast<LONG>(offsetof(FshHeader, size)));
+        if (e == noErr)
+        {
+            e = WriteInt32(file, static_cast<INT32>(fileSize));
+        }
+    }
+
+    return e;
+}
+
+static void ReportQFSCompressionSpeed(const DWORD rawLength,
+                                      const DWORD compressedLength,
+                                      const std::chrono::steady_clock::time_point& start,
+                                      const std::chrono::steady_clock::time_point& end)
+{
+    const double seconds = std::chrono::duration<double>(end - start).count();
+
+    if (seconds > 0.0)
+    {
+        DebugLog("FshFormat: QFS compressed %lu bytes to %lu bytes, %.2f MB/s raw, %.2f MB/s compressed.\n",
+                 static_cast<unsigned long>(rawLength),
+                 static_cast<unsigned long>(compressedLength),
+                 (static_cast<double>(rawLength) / seconds) / 1048576.0,
+                 (static_cast<double>(compressedLength) / seconds) / 1048576.0);
+    }
+}
+
+OSErr QFSCompressFileData(FshAllocator& allocator,
+                          HANDLE file,
+                          const LONG offset,
+                          const bool prefixCompressedLength,
+                          const QFSCompressionLevel level,
+                          DWORD* compressedLength,
+                          QFSCompressionStats* stats)
+{
+    *compressedLength = 0;
+
+    INT64 fileSize;
+    OSErr e = GetFileSize(file, &fileSize);
+
+    // Files that are larger than 2GB are left uncompressed because the Photoshop Buffer suite uses
+    // a signed 32-bit integer for the memory amount.
+    if (e != noErr || fileSize > INT_MAX || fileSize <= offset)
+    {
+        return e;
+    }
+
+    const DWORD rawLength = static_cast<DWORD>(fileSize - offset);
+
+    void* rawBuffer;
+    e = allocator.Allocate(rawLength, &rawBuffer);
+
+    if (e == noErr)
+    {
+        BYTE* rawData = static_cast<BYTE*>(rawBuffer);
+
+        e = SetFilePosition(file, FILE_BEGIN, offset);
+
+        if (e == noErr)
+        {
+            e = ReadBytes(file, rawData, rawLength);
+
+            if (e == noErr)
+            {
+                void* compressedBuffer;
+                e = allocator.Allocate(rawLength, &compressedBuffer);
+
+                if (e == noErr)
+                {
+                    BYTE* compressedData = static_cast<BYTE*>(compressedBuffer);
+
+                    DWORD length = 0;
+
+                    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                    e = QFSCompress(rawData, rawLength, compressedData, rawLength, level, prefixCompressedLength, &length);
+                    const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+                    if (e == noErr && stats != nullptr)
+                    {
+                        stats->rawLength = rawLength;
+                        stats->compressedLength = length;
+                        stats->compressTime = std::chrono::duration<double, std::milli>(end - start).count();
+                    }
+
+                    if (e == noErr && length > 0)
+                    {
+                        ReportQFSCompressionSpeed(rawLength, length, start, end);
+
+                        e = SetFilePosition(file, FILE_BEGIN, offset);
+
+                        if (e == noErr)
+                        {
+                            e = WriteBytes(file, compressedData, length);
+
+                            if (e == noErr)
+                            {
+                                e = TruncateFile(file);
+
+                                if (e == noErr)
+                                {
+                                    *compressedLength = length;
+                                }
+                            }
+                        }
+                    }
+
+                    allocator.Free(compressedBuffer);
+                }
+            }
+        }
+
+        allocator.Free(rawBuffer);
+    }
+
+    return e;
+}
+
+OSErr QFSCompressFsh(FshAllocator& allocator, HANDLE file, const QFSCompressionLevel level, QFSCompressionStats* stats)
+{
+    DWORD compressedLength;
+
+    return QFSCompressFileData(allocator, file, 0, true, level, &compressedLength, stats);
+}
+
+OSErr QFSCompressFshEntry(FshAllocator& allocator,
+                          HANDLE file,
+                          const FshDirEntry& dir,
+                          const FshBmpEntry& entry,
+                          const QFSCompressionLevel level,
+                          QFSCompressionStats* stats)
+{
+    DWORD compressedLength;
+
+    OSErr e = QFSCompressFileData(allocator, file, dir.offset + sizeof(FshBmpEntry), false, level, &compressedLength, stats);
+
+    if (e == noErr && compressedLength > 0)
+    {
+        const DWORD entrySize = sizeof(FshBmpEntry) + compressedLength;
+
+        FshBmpEntry newEntry = entry;
+        newEntry.code = (entrySize << 8) | 0x80 | (entry.code & 0x7f);
+
+        BufferedFileWriter writer(file);
+
+        e = WriteFshEntryDir(writer, dir, newEntry);
+
+        if (e == noErr)
+        {
+            e = writer.Flush();
+        }
+    }
+
+    return e;
+}
+
+OSErr IsValidFshFile(FshAllocator& allocator, HANDLE hFile)
+{
+    OSErr e = noErr;
+
+    e = DecompressFsh(allocator, hFile);
     if (e == noErr)
     {
         // ReadFshHeader will return formatCannotRead if the header signature is not valid.
 
+        BufferedFileReader reader(hFile);
+
         FshHeader header;
-        e = ReadFshHeader(hFile, &header);
+        e = ReadFshHeader(reader, &header);
 
         if (e == noErr && header.numBmps < 1)
         {
             e = formatCannotRead;
         }
 
-        if (qfsBuffer != nullptr)
-        {
-            pb->bufferProcs->unlockProc(qfsBufferID);
-            pb->bufferProcs->freeProc(qfsBufferID);
-        }
+        FreeDecompressedFsh(allocator);
     }
 
     return e;
@@ -23,6 +23,9 @@
 #define FshIo_H
 
 #include "Common.h"
+#include "FileIo.h"
+#include "FshAllocator.h"
+#include "QFS.h"
 
 struct FshHeader
 {
@@ -51,6 +54,8 @@ static_assert(sizeof(FshDirEntry) == 8, "sizeof(FshDirEntry) != 8");
 static_assert(sizeof(FshBmpEntry) == 16, "sizeof(FshBmpEntry) != 16");
 
 
+class FshArchiveIndex;
+
 enum FshBmpType
 {
 	// DXT1 Compressed, 4x4 packed with 1-bit alpha.
@@ -71,40 +76,95 @@ enum FshBmpType
 	// EightBit = 0x7B
 };
 
-// Counts the number of mipmaps contained in the specified image entry.
-OSErr CountEntryMipMaps(HANDLE file, const FshHeader& header, const FshDirEntry& dir, const FshBmpEntry& entry, int* count, bool* packed);
+// Gets the uncompressed size of a QFS compressed image entry.
+OSErr GetEntryUncompressedSize(HANDLE file, const FshDirEntry& dir, int* uncompressedSize);
 
+// Checks if the image format can be loaded.
+bool IsSupportedFshBmpType(const FshBmpType code);
 // Checks the file for unsupported image formats.
-OSErr CheckFshBmpTypes(HANDLE file, const FshHeader& header);
-// Decompresses a QFS compressed file.
-OSErr DecompressFsh(FormatRecordPtr pb, HANDLE file);
+OSErr CheckFshBmpTypes(FshArchiveIndex& index);
+// Starts decompressing a QFS compressed file, the data is decompressed on demand as it is read.
+OSErr DecompressFsh(FshAllocator& allocator, HANDLE file);
+// Decompresses the file until the data before endOffset is available.
+OSErr DecompressFshRange(const DWORD endOffset);
+// Checks if the data before endOffset has already been decompressed.
+bool IsFshRangeDecompressed(const DWORD endOffset);
+// Frees the decompressed file and the decoder state.
+void FreeDecompressedFsh(FshAllocator& allocator);
+// Gets a pointer to the file data when the file is QFS compressed or memory mapped,
+// data is set to nullptr when the file has to be read.
+OSErr GetInMemoryFshData(const DWORD offset, const DWORD length, const BYTE** data);
+// Maps an uncompressed file into memory, the readers fall back to the buffered file reads if this fails.
+OSErr MapFsh(HANDLE file);
+void UnmapFsh();
 
-OSErr GetFshBmpInfo(HANDLE file, const int index, FshBmpEntry* entry);
 int GetImageDataSize(const int width, const int height, const FshBmpType format);
 
 // Reads the header and validates the file signature.
-OSErr ReadFshHeader(HANDLE file, FshHeader* header);
+OSErr ReadFshHeader(BufferedFileReader& file, FshHeader* header);
 // Reads the file directory at the specified index.
-OSErr ReadFshDir(HANDLE file, const int index, FshDirEntry* dir);
+OSErr ReadFshDir(BufferedFileReader& file, const int index, FshDirEntry* dir);
 // Reads the image entry.
-OSErr ReadFshEntryDir(HANDLE file, const FshDirEntry& dir, FshBmpEntry* entry);
+OSErr ReadFshEntryDir(BufferedFileReader& file, const FshDirEntry& dir, FshBmpEntry* entry);
 // Reads the image data.
-OSErr ReadFshImageData(FormatRecordPtr pb,
-						const FshHeader& header,
-						const FshDirEntry& dir,
+OSErr ReadFshImageData(FshAllocator& allocator,
+						const FshArchiveIndex& index,
+						const int entryIndex,
 						const FshBmpEntry& entry,
 						void* outData,
 						const DWORD outLength);
+// Gets the size of the uncompressed image data, for QFS compressed entries this includes the mipmaps.
+OSErr GetFshImageDataSize(const FshArchiveIndex& index, const int entryIndex, const FshBmpEntry& entry, int* dataSize);
+// Gets a pointer to the uncompressed image data when the file is in memory,
+// view is set to nullptr when the image data has to be read with ReadFshImageData.
+OSErr GetFshImageDataView(const FshArchiveIndex& index,
+						  const int entryIndex,
+						  const FshBmpEntry& entry,
+						  const DWORD length,
+						  const void** view);
 // Writes the header.
-OSErr WriteFshHeader(HANDLE file, const FshHeader& header);
+OSErr WriteFshHeader(BufferedFileWriter& file, const FshHeader& header);
 // Writes the file directory entry.
-OSErr WriteFshDir(HANDLE file, const FshDirEntry& dir);
+OSErr WriteFshDir(BufferedFileWriter& file, const FshDirEntry& dir);
 // Writes the image entry.
-OSErr WriteFshEntryDir(HANDLE file, const FshDirEntry& dir, const FshBmpEntry& entry);
+OSErr WriteFshEntryDir(BufferedFileWriter& file, const FshDirEntry& dir, const FshBmpEntry& entry);
 // Writes the image data.
 OSErr WriteFshImageData(HANDLE file, const void* inData, const int length);
+// Sets the entry size from the current file position and stores the mipmap count in the entry header.
+OSErr UpdateFshEntryHeader(HANDLE file, const FshDirEntry& dir, const FshBmpEntry& entry, const int mipCount);
+// Updates the header with the current length of the file.
+OSErr WriteFshFileLength(HANDLE file);
+// The amount of data that QFSCompressFileData compressed and the time that the compressor took, in milliseconds.
+// compressedLength is zero when compression did not reduce the size.
+struct QFSCompressionStats
+{
+	DWORD rawLength;
+	DWORD compressedLength;
+	double compressTime;
+};
+
+// Replaces the data from the specified offset to the end of the file with a QFS compressed copy.
+// The file is left unchanged and compressedLength is set to zero if compression does not reduce the size.
+// stats can be nullptr, it is left unchanged when there is no data to compress.
+OSErr QFSCompressFileData(FshAllocator& allocator,
+						  HANDLE file,
+						  const LONG offset,
+						  const bool prefixCompressedLength,
+						  const QFSCompressionLevel level,
+						  DWORD* compressedLength,
+						  QFSCompressionStats* stats);
+// Replaces the file with a QFS compressed copy, the file is left unchanged if compression does not reduce its size.
+OSErr QFSCompressFsh(FshAllocator& allocator, HANDLE file, const QFSCompressionLevel level, QFSCompressionStats* stats);
+// Compresses the bitmap and mipmap data of the last entry in the file as a single QFS stream, so the entry
+// can be decompressed without decompressing the rest of the file. The entry header is updated to mark it as compressed.
+OSErr QFSCompressFshEntry(FshAllocator& allocator,
+						  HANDLE file,
+						  const FshDirEntry& dir,
+						  const FshBmpEntry& entry,
+						  const QFSCompressionLevel level,
+						  QFSCompressionStats* stats);
 
 // Determines weather the image is a valid Fsh file.
-OSErr IsValidFshFile(FormatRecordPtr pb);
+OSErr IsValidFshFile(FshAllocator& allocator, HANDLE file);
 
 #endif
\ No newline at end of file
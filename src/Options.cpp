@@ -48,6 +48,8 @@ OSErr DoOptionsStart(FormatRecordPtr pb, Globals* globals)
             memcpy(globals->headerDir, rev->headerDir, 4);
             globals->mipCount = rev->mipCount;
             globals->mipPacked = rev->mipPacked;
+            globals->qfsCompression = rev->qfsCompressed;
+            globals->qfsEntryCompression = rev->qfsEntryCompressed;
 
             pb->handleProcs->unlockProc(pb->revertInfo);
         }
@@ -66,6 +68,8 @@ OSErr DoOptionsStart(FormatRecordPtr pb, Globals* globals)
         {
             globals->fshCode = options.fshType;
             globals->fshWriteCompression = options.fshWriteCompression;
+            globals->qfsCompression = options.qfsCompression;
+            globals->qfsEntryCompression = options.qfsEntryCompression;
             if (options.entryDirName[0] != 0)
             {
                 memcpy(globals->entryDir, options.entryDirName, 4);
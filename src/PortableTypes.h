@@ -0,0 +1,75 @@
+/*
+*  This file is part of FshFormat, a file format plug-in for Adobe Photoshop(R)
+*  that loads and saves FSH images.
+*
+*  Copyright (C) 2011, 2012, 2013, 2014, 2015, 2022, 2023 Nicholas Hayes
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+
+#ifndef PORTABLETYPES_H
+#define PORTABLETYPES_H
+
+// The Windows and Photoshop SDK types that are used by the core library, for builds that do not
+// have the SDK headers. The error codes have the same values as the Mac OS and Photoshop ones.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#if !WIN32
+
+typedef uint8_t BYTE;
+typedef uint32_t DWORD;
+typedef int32_t LONG;
+typedef int32_t INT32;
+typedef uint16_t UINT16;
+typedef uint32_t UINT32;
+typedef int64_t INT64;
+typedef uint64_t UINT64;
+// POSIX builds store the file descriptor in the handle.
+typedef void* HANDLE;
+
+#define MAXDWORD 0xffffffff
+
+#define FILE_BEGIN SEEK_SET
+#define FILE_CURRENT SEEK_CUR
+#define FILE_END SEEK_END
+
+#define ZeroMemory(dest, length) memset((dest), 0, (length))
+#define UNREFERENCED_PARAMETER(param) ((void)(param))
+
+#endif // !WIN32
+
+typedef int16_t OSErr;
+typedef int32_t int32;
+typedef int16_t int16;
+
+enum
+{
+	noErr = 0,
+	writErr = -20,
+	ioErr = -36,
+	eofErr = -39,
+	paramErr = -50,
+	memFullErr = -108,
+	userCanceledErr = -128,
+	formatBadParameters = -30500,
+	formatCannotRead = -30501
+};
+
+#endif // !PORTABLETYPES_H
@@ -23,120 +23,929 @@
 #include "FileIo.h"
 #include "QFS.h"
 #include "QFSHeader.h"
+#include <memory>
+#include <new>
+#include <string.h>
 
-BufferID qfsBufferID;
 BYTE* qfsBuffer = nullptr;
 
-OSErr QFSDecompress(const BYTE* inData, const DWORD inLength, BYTE* outData, const DWORD outLength)
+// The maximum copy offset that can be encoded by the 4 byte op code.
+static const DWORD QfsWindowSize = 131072;
+static const DWORD QfsWindowMask = QfsWindowSize - 1;
+static const int QfsMaxCopyCount = 1028;
+static const int QfsMaxPlainCount = 112;
+static const int QfsHashBits = 16;
+static const int QfsHashSize = 1 << QfsHashBits;
+
+struct QFSCompressionSettings
 {
-    if (inData == nullptr || outData == nullptr)
+    int maxChainLength;
+    bool lazyMatching;
+};
+
+static const QFSCompressionSettings qfsCompressionSettings[] =
+{
+    { 8, false },   // QFSCompressionFast
+    { 64, true },   // QFSCompressionNormal
+    { 1024, true }  // QFSCompressionMax
+};
+
+// Finds the longest previous match for a position using hash chains over the 128 KiB window.
+class QFSMatchFinder
+{
+public:
+    QFSMatchFinder(const BYTE* data, const DWORD dataLength, int* head, int* prev, const int maxChainLength)
+        : data(data), dataLength(dataLength), head(head), prev(prev), maxChainLength(maxChainLength), hashIndex(0)
     {
-        return paramErr;
+        for (int i = 0; i < QfsHashSize; i++)
+        {
+            head[i] = -1;
+        }
     }
 
-    try
+    // Adds every position before the specified index to the hash chains.
+    void Update(const DWORD index)
     {
-        QFSHeader header(inData, inLength);
+        while (hashIndex < index && (dataLength - hashIndex) >= 3)
+        {
+            const DWORD hash = Hash(data + hashIndex);
 
-        const DWORD uncompressedSize = static_cast<DWORD>(header.GetUncompressedSize());
+            prev[hashIndex & QfsWindowMask] = head[hash];
+            head[hash] = static_cast<int>(hashIndex);
+            hashIndex++;
+        }
+    }
+
+    // Finds the match that saves the most bytes after accounting for the op code length.
+    void FindMatch(const DWORD index, int* copyCount, int* copyOffset) const
+    {
+        *copyCount = 0;
+        *copyOffset = 0;
+
+        const DWORD remaining = dataLength - index;
 
-        if (outLength < uncompressedSize)
+        if (remaining < 3)
         {
-            return paramErr;
+            return;
         }
 
-        DWORD index = static_cast<DWORD>(header.GetDataStartOffset());
-
-        BYTE ccbyte1 = 0; // control char 1
-        BYTE ccbyte2 = 0; // control char 2
-        BYTE ccbyte3 = 0; // control char 3
-        BYTE ccbyte4 = 0; // control char 4
-        int plainCount = 0;
-        int copyCount = 0;
-        int copyOffset = 0;
+        const int maxCount = remaining < QfsMaxCopyCount ? static_cast<int>(remaining) : QfsMaxCopyCount;
+        const BYTE* current = data + index;
 
-        DWORD outIndex = 0;
+        int bestCount = 0;
+        int bestSavings = 0;
+        int chainLength = maxChainLength;
+        int candidate = head[Hash(current)];
 
-        while (index < inLength && inData[index] < 0xFC)
+        while (candidate >= 0 && chainLength-- > 0)
         {
-            ccbyte1 = inData[index++];
+            const DWORD offset = index - static_cast<DWORD>(candidate);
 
-            if (ccbyte1 >= 0xE0) // 1 byte op code 0xE0 - 0xFB
+            if (offset > QfsWindowSize)
             {
-                plainCount = ((ccbyte1 & 0x1F) << 2) + 4;
-                copyCount = 0;
-                copyOffset = 0;
+                break;
             }
-            else if (ccbyte1 >= 0xC0) // 4 byte op code 0xC0 - 0xDF
+
+            const BYTE* match = data + candidate;
+
+            if (match[bestCount] == current[bestCount] && match[0] == current[0] && match[1] == current[1])
             {
-                ccbyte2 = inData[index++];
-                ccbyte3 = inData[index++];
-                ccbyte4 = inData[index++];
+                int count = 2;
+
+                while (count < maxCount && match[count] == current[count])
+                {
+                    count++;
+                }
 
-                plainCount = (ccbyte1 & 3);
-                copyCount = ((ccbyte1 & 0x0C) << 6) + ccbyte4 + 5;
-                copyOffset = (((ccbyte1 & 0x10) << 12) + (ccbyte2 << 8)) + ccbyte3 + 1;
+                const int savings = count - GetOpCodeLength(count, offset);
+
+                if (count > bestCount && savings > bestSavings)
+                {
+                    bestCount = count;
+                    bestSavings = savings;
+                    *copyCount = count;
+                    *copyOffset = static_cast<int>(offset);
+
+                    if (count == maxCount)
+                    {
+                        break;
+                    }
+                }
             }
-            else if (ccbyte1 >= 0x80) // 3 byte op code 0x80 - 0xBF
-            {
-                ccbyte2 = inData[index++];
-                ccbyte3 = inData[index++];
 
-                plainCount = (ccbyte2 & 0xC0) >> 6;
-                copyCount = (ccbyte1 & 0x3F) + 4;
-                copyOffset = ((ccbyte2 & 0x3F) << 8) + ccbyte3 + 1;
+            const int next = prev[candidate & QfsWindowMask];
+
+            if (next >= candidate)
+            {
+                break;
             }
-            else // 2 byte op code 0x00 - 0x7F
+
+            candidate = next;
+        }
+    }
+
+    // Gets the number of bytes required to encode a copy, or the copy count if it cannot be encoded.
+    static int GetOpCodeLength(const int copyCount, const DWORD copyOffset)
+    {
+        if (copyCount >= 3 && copyCount <= 10 && copyOffset <= 1024)
+        {
+            return 2;
+        }
+        else if (copyCount >= 4 && copyCount <= 67 && copyOffset <= 16384)
+        {
+            return 3;
+        }
+        else if (copyCount >= 5 && copyOffset <= QfsWindowSize)
+        {
+            return 4;
+        }
+
+        return copyCount;
+    }
+
+private:
+    static DWORD Hash(const BYTE* p)
+    {
+        const DWORD value = (static_cast<DWORD>(p[0]) << 16) | (static_cast<DWORD>(p[1]) << 8) | p[2];
+
+        return (value * 2654435761U) >> (32 - QfsHashBits);
+    }
+
+    const BYTE* data;
+    const DWORD dataLength;
+    int* head;
+    int* prev;
+    const int maxChainLength;
+    DWORD hashIndex;
+};
+
+// Writes the pending plain bytes as 1 byte op codes, the remaining 0 to 3 bytes are written by the next op code.
+static bool WritePlainRuns(const BYTE* inData, DWORD* plainStart, const DWORD plainEnd, BYTE* outData, const DWORD outLength, DWORD* outIndex)
+{
+    while ((plainEnd - *plainStart) >= 4)
+    {
+        const DWORD plainCount = plainEnd - *plainStart;
+        const DWORD runLength = plainCount > QfsMaxPlainCount ? QfsMaxPlainCount : (plainCount & ~3);
+
+        if ((outLength - *outIndex) <= runLength)
+        {
+            return false;
+        }
+
+        outData[*outIndex] = static_cast<BYTE>(0xE0 + ((runLength - 4) >> 2));
+        memcpy(outData + *outIndex + 1, inData + *plainStart, runLength);
+
+        *outIndex += runLength + 1;
+        *plainStart += runLength;
+    }
+
+    return true;
+}
+
+static bool WriteCopyOpCode(const BYTE* plainData, const int plainCount, const int copyCount, const int copyOffset, BYTE* outData, const DWORD outLength, DWORD* outIndex)
+{
+    const int offset = copyOffset - 1;
+
+    BYTE opCode[4];
+    DWORD opCodeLength;
+
+    if (copyCount <= 10 && copyOffset <= 1024) // 2 byte op code 0x00 - 0x7F
+    {
+        opCode[0] = static_cast<BYTE>(((offset >> 8) << 5) | ((copyCount - 3) << 2) | plainCount);
+        opCode[1] = static_cast<BYTE>(offset);
+        opCodeLength = 2;
+    }
+    else if (copyCount <= 67 && copyOffset <= 16384) // 3 byte op code 0x80 - 0xBF
+    {
+        opCode[0] = static_cast<BYTE>(0x80 | (copyCount - 4));
+        opCode[1] = static_cast<BYTE>((plainCount << 6) | (offset >> 8));
+        opCode[2] = static_cast<BYTE>(offset);
+        opCodeLength = 3;
+    }
+    else // 4 byte op code 0xC0 - 0xDF
+    {
+        opCode[0] = static_cast<BYTE>(0xC0 | ((offset >> 16) << 4) | (((copyCount - 5) >> 8) << 2) | plainCount);
+        opCode[1] = static_cast<BYTE>(offset >> 8);
+        opCode[2] = static_cast<BYTE>(offset);
+        opCode[3] = static_cast<BYTE>(copyCount - 5);
+        opCodeLength = 4;
+    }
+
+    if ((outLength - *outIndex) < (opCodeLength + plainCount))
+    {
+        return false;
+    }
+
+    memcpy(outData + *outIndex, opCode, opCodeLength);
+    memcpy(outData + *outIndex + opCodeLength, plainData, plainCount);
+    *outIndex += opCodeLength + plainCount;
+
+    return true;
+}
+
+OSErr QFSCompress(const BYTE* inData,
+                  const DWORD inLength,
+                  BYTE* outData,
+                  const DWORD outLength,
+                  const QFSCompressionLevel level,
+                  const bool prefixCompressedLength,
+                  DWORD* compressedLength)
+{
+    *compressedLength = 0;
+
+    if (inData == nullptr || outData == nullptr || level < QFSCompressionFast || level > QFSCompressionMax)
+    {
+        return paramErr;
+    }
+
+    // Sim City 4 prefixes the signature with the compressed length, compressed bitmap entries start with the signature.
+    // Data larger than 16 MB uses a 32-bit uncompressed length.
+    const bool largeFileLength = inLength > 0xFFFFFF;
+    const DWORD signatureOffset = prefixCompressedLength ? 4 : 0;
+    const DWORD headerLength = signatureOffset + (largeFileLength ? 6 : 5);
+
+    if (outLength <= headerLength)
+    {
+        return noErr;
+    }
+
+    std::unique_ptr<int[]> head;
+    std::unique_ptr<int[]> prev;
+
+    try
+    {
+        head.reset(new int[QfsHashSize]);
+        prev.reset(new int[QfsWindowSize]);
+    }
+    catch (const std::bad_alloc&)
+    {
+        return memFullErr;
+    }
+
+    const QFSCompressionSettings& settings = qfsCompressionSettings[level];
+
+    QFSMatchFinder matchFinder(inData, inLength, head.get(), prev.get(), settings.maxChainLength);
+
+    DWORD index = 0;
+    DWORD plainStart = 0;
+    DWORD outIndex = headerLength;
+
+    while ((inLength - index) >= 3)
+    {
+        int copyCount;
+        int copyOffset;
+
+        matchFinder.Update(index);
+        matchFinder.FindMatch(index, &copyCount, &copyOffset);
+
+        if (copyCount == 0)
+        {
+            index++;
+            continue;
+        }
+
+        if (settings.lazyMatching)
+        {
+            // Emit the current byte as a plain byte if a match at the next position saves more bytes.
+            while (copyCount < QfsMaxCopyCount && (inLength - index) > 3)
             {
-                ccbyte2 = inData[index++];
+                int nextCount;
+                int nextOffset;
+
+                matchFinder.Update(index + 1);
+                matchFinder.FindMatch(index + 1, &nextCount, &nextOffset);
+
+                if ((nextCount - QFSMatchFinder::GetOpCodeLength(nextCount, nextOffset)) <=
+                    (copyCount - QFSMatchFinder::GetOpCodeLength(copyCount, copyOffset)))
+                {
+                    break;
+                }
+
+                index++;
+                copyCount = nextCount;
+                copyOffset = nextOffset;
+            }
+        }
+
+        if (!WritePlainRuns(inData, &plainStart, index, outData, outLength, &outIndex) ||
+            !WriteCopyOpCode(inData + plainStart, static_cast<int>(index - plainStart), copyCount, copyOffset, outData, outLength, &outIndex))
+        {
+            return noErr;
+        }
+
+        index += copyCount;
+        plainStart = index;
+    }
+
+    if (!WritePlainRuns(inData, &plainStart, inLength, outData, outLength, &outIndex))
+    {
+        return noErr;
+    }
+
+    // Write the 1 byte EOF op code 0xFC - 0xFF and the trailing bytes.
+    const DWORD plainCount = inLength - plainStart;
+
+    if ((outLength - outIndex) <= plainCount)
+    {
+        return noErr;
+    }
+
+    outData[outIndex] = static_cast<BYTE>(0xFC | plainCount);
+    memcpy(outData + outIndex + 1, inData + plainStart, plainCount);
+    outIndex += plainCount + 1;
+
+    if (prefixCompressedLength)
+    {
+        outData[0] = static_cast<BYTE>(outIndex);
+        outData[1] = static_cast<BYTE>(outIndex >> 8);
+        outData[2] = static_cast<BYTE>(outIndex >> 16);
+        outData[3] = static_cast<BYTE>(outIndex >> 24);
+    }
+
+    BYTE* header = outData + signatureOffset;
+
+    header[0] = largeFileLength ? 0x90 : 0x10;
+    header[1] = 0xFB;
+
+    if (largeFileLength)
+    {
+        header[2] = static_cast<BYTE>(inLength >> 24);
+        header[3] = static_cast<BYTE>(inLength >> 16);
+        header[4] = static_cast<BYTE>(inLength >> 8);
+        header[5] = static_cast<BYTE>(inLength);
+    }
+    else
+    {
+        header[2] = static_cast<BYTE>(inLength >> 16);
+        header[3] = static_cast<BYTE>(inLength >> 8);
+        header[4] = static_cast<BYTE>(inLength);
+    }
+
+    *compressedLength = outIndex;
+
+    return noErr;
+}
+
+// The number of bytes the fast copy routines may read or write past the end of a run.
+static const DWORD QfsFastCopyMargin = 16;
 
-                plainCount = (ccbyte1 & 3);
-                copyCount = ((ccbyte1 & 0x1C) >> 2) + 3;
-                copyOffset = ((ccbyte1 >> 5) << 8) + ccbyte2 + 1;
+// Copies a literal run in 16 byte blocks, the caller must ensure QfsFastCopyMargin bytes of slack.
+static inline void FastCopyPlain(BYTE* dst, const BYTE* src, const int count)
+{
+    BYTE* const end = dst + count;
+
+    do
+    {
+        memcpy(dst, src, 16);
+        dst += 16;
+        src += 16;
+    } while (dst < end);
+}
+
+// Copies a back-reference with wide copies, the caller must ensure QfsFastCopyMargin bytes of slack.
+static inline void FastCopyMatch(BYTE* dst, const int copyOffset, const int count)
+{
+    BYTE* const end = dst + count;
+    const BYTE* src = dst - copyOffset;
+
+    if (copyOffset >= 16)
+    {
+        do
+        {
+            memcpy(dst, src, 16);
+            dst += 16;
+            src += 16;
+        } while (dst < end);
+    }
+    else
+    {
+        int offset = copyOffset;
+
+        if (offset < 8)
+        {
+            // Replicate the pattern byte by byte until the source is at least 8 bytes behind,
+            // a multiple of the pattern length repeats the same bytes.
+            for (int i = 0; i < 8; i++)
+            {
+                dst[i] = src[i];
             }
+            dst += 8;
 
-            for (int i = 0; i < plainCount; i++)
+            while (offset < 8)
             {
-                outData[outIndex] = inData[index];
-                index++;
-                outIndex++;
+                offset += copyOffset;
             }
+            src = dst - offset;
+        }
 
-            if (copyCount > 0)
+        while (dst < end)
+        {
+            memcpy(dst, src, 8);
+            dst += 8;
+            src += 8;
+        }
+    }
+}
+
+OSErr QFSDecompress(const BYTE* inData, const DWORD inLength, BYTE* outData, const DWORD outLength)
+{
+    return QFSDecompress(inData, inLength, outData, outLength, nullptr);
+}
+
+OSErr QFSDecompress(const BYTE* inData, const DWORD inLength, BYTE* outData, const DWORD outLength, QFSDecompressStatus* status)
+{
+    DWORD index = 0;
+    DWORD outIndex = 0;
+    OSErr err = noErr;
+
+    if (inData == nullptr || outData == nullptr)
+    {
+        err = paramErr;
+    }
+    else
+    {
+        QFSHeader header;
+        err = header.Read(inData, inLength);
+
+        if (err == noErr)
+        {
+            const DWORD uncompressedSize = static_cast<DWORD>(header.GetUncompressedSize());
+
+            if (outLength < uncompressedSize)
             {
-                int srcIndex = outIndex - copyOffset;
+                err = paramErr;
+            }
+            else
+            {
+                index = static_cast<DWORD>(header.GetDataStartOffset());
+
+                BYTE ccbyte1 = 0; // control char 1
+                BYTE ccbyte2 = 0; // control char 2
+                BYTE ccbyte3 = 0; // control char 3
+                BYTE ccbyte4 = 0; // control char 4
+                DWORD plainCount = 0;
+                DWORD copyCount = 0;
+                DWORD copyOffset = 0;
 
-                for (int i = 0; i < copyCount; i++)
+                while (index < inLength && inData[index] < 0xFC)
                 {
-                    outData[outIndex] = outData[srcIndex];
-                    srcIndex++;
-                    outIndex++;
+                    const DWORD opCodeIndex = index;
+                    ccbyte1 = inData[index];
+
+                    if (ccbyte1 >= 0xE0) // 1 byte op code 0xE0 - 0xFB
+                    {
+                        plainCount = ((ccbyte1 & 0x1F) << 2) + 4;
+                        copyCount = 0;
+                        copyOffset = 0;
+
+                        if ((inLength - index) < (1 + plainCount))
+                        {
+                            err = formatCannotRead;
+                            break;
+                        }
+                        index++;
+                    }
+                    else if (ccbyte1 >= 0xC0) // 4 byte op code 0xC0 - 0xDF
+                    {
+                        plainCount = (ccbyte1 & 3);
+
+                        if ((inLength - index) < (4 + plainCount))
+                        {
+                            err = formatCannotRead;
+                            break;
+                        }
+
+                        ccbyte2 = inData[index + 1];
+                        ccbyte3 = inData[index + 2];
+                        ccbyte4 = inData[index + 3];
+                        index += 4;
+
+                        copyCount = ((ccbyte1 & 0x0C) << 6) + ccbyte4 + 5;
+                        copyOffset = (((ccbyte1 & 0x10) << 12) + (ccbyte2 << 8)) + ccbyte3 + 1;
+                    }
+                    else if (ccbyte1 >= 0x80) // 3 byte op code 0x80 - 0xBF
+                    {
+                        if ((inLength - index) < 3)
+                        {
+                            err = formatCannotRead;
+                            break;
+                        }
+
+                        ccbyte2 = inData[index + 1];
+                        ccbyte3 = inData[index + 2];
+
+                        plainCount = (ccbyte2 & 0xC0) >> 6;
+
+                        if ((inLength - index) < (3 + plainCount))
+                        {
+                            err = formatCannotRead;
+                            break;
+                        }
+                        index += 3;
+
+                        copyCount = (ccbyte1 & 0x3F) + 4;
+                        copyOffset = ((ccbyte2 & 0x3F) << 8) + ccbyte3 + 1;
+                    }
+                    else // 2 byte op code 0x00 - 0x7F
+                    {
+                        plainCount = (ccbyte1 & 3);
+
+                        if ((inLength - index) < (2 + plainCount))
+                        {
+                            err = formatCannotRead;
+                            break;
+                        }
+
+                        ccbyte2 = inData[index + 1];
+                        index += 2;
+
+                        copyCount = ((ccbyte1 & 0x1C) >> 2) + 3;
+                        copyOffset = ((ccbyte1 >> 5) << 8) + ccbyte2 + 1;
+                    }
+
+                    // The back-reference must stay within the data that has already been written.
+                    if ((uncompressedSize - outIndex) < (plainCount + copyCount) ||
+                        (copyCount > 0 && copyOffset > (outIndex + plainCount)))
+                    {
+                        index = opCodeIndex;
+                        err = formatCannotRead;
+                        break;
+                    }
+
+                    if ((inLength - index) >= (plainCount + QfsFastCopyMargin) &&
+                        (uncompressedSize - outIndex) >= (plainCount + copyCount + QfsFastCopyMargin))
+                    {
+                        // Fast region, the wide copies can overrun the end of the run without leaving the buffers.
+                        if (plainCount > 0)
+                        {
+                            FastCopyPlain(outData + outIndex, inData + index, plainCount);
+                            index += plainCount;
+                            outIndex += plainCount;
+                        }
+
+                        if (copyCount > 0)
+                        {
+                            FastCopyMatch(outData + outIndex, copyOffset, copyCount);
+                            outIndex += copyCount;
+                        }
+                    }
+                    else
+                    {
+                        // Careful region near the end of the buffers, copy one byte at a time.
+                        for (DWORD i = 0; i < plainCount; i++)
+                        {
+                            outData[outIndex] = inData[index];
+                            index++;
+                            outIndex++;
+                        }
+
+                        if (copyCount > 0)
+                        {
+                            DWORD srcIndex = outIndex - copyOffset;
+
+                            for (DWORD i = 0; i < copyCount; i++)
+                            {
+                                outData[outIndex] = outData[srcIndex];
+                                srcIndex++;
+                                outIndex++;
+                            }
+                        }
+                    }
+                }
+
+                // Write the trailing bytes.
+                if (err == noErr && index < inLength && outIndex < uncompressedSize)
+                {
+                    // 1 byte EOF op code 0xFC - 0xFF.
+                    plainCount = (inData[index] & 3);
+
+                    if ((inLength - index) < (1 + plainCount) || (uncompressedSize - outIndex) < plainCount)
+                    {
+                        err = formatCannotRead;
+                    }
+                    else
+                    {
+                        index++;
+
+                        for (DWORD i = 0; i < plainCount; i++)
+                        {
+                            outData[outIndex] = inData[index];
+                            index++;
+                            outIndex++;
+                        }
+                    }
+                }
+
+                // The stream must produce all of the data that the header declares.
+                if (err == noErr && outIndex != uncompressedSize)
+                {
+                    err = formatCannotRead;
                 }
             }
         }
+    }
+
+    if (status != nullptr)
+    {
+        status->error = err;
+        status->inputOffset = index;
+        status->outputOffset = outIndex;
+    }
+
+    return err;
+}
+
+// The window keeps two history windows so that it only has to be shifted once every 128 KiB.
+static const DWORD QfsStreamWindowSize = (2 * QfsWindowSize) + QfsMaxCopyCount + 3 + QfsFastCopyMargin;
+static const DWORD QfsMaxHeaderLength = 14;
+
+// Gets the length of the op code and its literal bytes, or 0 if more bytes are needed to determine it.
+static DWORD GetOpCodeLength(const BYTE* data, const DWORD length)
+{
+    if (length == 0)
+    {
+        return 0;
+    }
+
+    const BYTE ccbyte1 = data[0];
 
-        // Write the trailing bytes.
-        if (index < inLength && outIndex < uncompressedSize)
+    if (ccbyte1 >= 0xFC) // 1 byte EOF op code 0xFC - 0xFF
+    {
+        return 1 + (ccbyte1 & 3);
+    }
+    else if (ccbyte1 >= 0xE0) // 1 byte op code 0xE0 - 0xFB
+    {
+        return 1 + ((ccbyte1 & 0x1F) << 2) + 4;
+    }
+    else if (ccbyte1 >= 0xC0) // 4 byte op code 0xC0 - 0xDF
+    {
+        return 4 + (ccbyte1 & 3);
+    }
+    else if (ccbyte1 >= 0x80) // 3 byte op code 0x80 - 0xBF
+    {
+        return length >= 2 ? 3 + ((data[1] & 0xC0) >> 6) : 0;
+    }
+    else // 2 byte op code 0x00 - 0x7F
+    {
+        return 2 + (ccbyte1 & 3);
+    }
+}
+
+QFSStreamDecoder::QFSStreamDecoder()
+    : window(new BYTE[QfsStreamWindowSize]), writeIndex(0), readIndex(0), totalOut(0), uncompressedSize(0),
+      headerLength(0), pendingLength(0), headerRead(false), finished(false), error(noErr)
+{
+}
+
+OSErr QFSStreamDecoder::ReadHeader(const BYTE* data, const DWORD length, DWORD* consumed)
+{
+    DWORD index = 0;
+
+    while (!headerRead && index < length)
+    {
+        headerBytes[headerLength++] = data[index++];
+
+        // The shortest header is 5 bytes followed by the first op code.
+        if (headerLength >= 6)
         {
-            // 1 byte EOF op code 0xFC - 0xFF.
-            plainCount = (inData[index++] & 3);
+            const DWORD signatureOffset = QFSHeader::CheckSignature(reinterpret_cast<const BYTE(&)[2]>(headerBytes)) ? 0 : 4;
+            const BYTE flags = headerBytes[signatureOffset];
+            const DWORD sizeFieldByteCount = (flags & 0x80) != 0 ? 4 : 3;
+            const DWORD sizeFieldCount = (flags & 0x01) != 0 ? 2 : 1;
 
-            for (int i = 0; i < plainCount; i++)
+            // QFSHeader requires at least one byte after the header.
+            if (headerLength > (signatureOffset + 2 + (sizeFieldByteCount * sizeFieldCount)) || headerLength > QfsMaxHeaderLength)
             {
-                outData[outIndex] = inData[index];
-                index++;
-                outIndex++;
+                QFSHeader header;
+                const OSErr headerError = header.Read(headerBytes, headerLength);
+
+                if (headerError != noErr)
+                {
+                    *consumed = index;
+                    return headerError;
+                }
+
+                uncompressedSize = static_cast<DWORD>(header.GetUncompressedSize());
+
+                headerRead = true;
+                finished = uncompressedSize == 0;
+
+                // The last byte belongs to the first op code.
+                index--;
             }
         }
     }
-    catch (const OSErr e)
+
+    *consumed = index;
+
+    return noErr;
+}
+
+bool QFSStreamDecoder::EnsureWindowSpace(const DWORD count)
+{
+    if ((writeIndex + count + QfsFastCopyMargin) > QfsStreamWindowSize)
+    {
+        // Discard the data that has been drained and is no longer needed for the history.
+        DWORD shift = writeIndex > QfsWindowSize ? writeIndex - QfsWindowSize : 0;
+        if (shift > readIndex)
+        {
+            shift = readIndex;
+        }
+
+        if (shift > 0)
+        {
+            memmove(window.get(), window.get() + shift, writeIndex - shift);
+            writeIndex -= shift;
+            readIndex -= shift;
+        }
+    }
+
+    return (writeIndex + count + QfsFastCopyMargin) <= QfsStreamWindowSize;
+}
+
+OSErr QFSStreamDecoder::DecodeOpCode(const BYTE* opCode, const DWORD opCodeLength, const bool plainCopySlack, bool* windowFull)
+{
+    const BYTE ccbyte1 = opCode[0];
+    DWORD plainCount;
+    DWORD copyCount;
+    DWORD copyOffset;
+    const BYTE* plain;
+
+    *windowFull = false;
+
+    if (ccbyte1 >= 0xE0) // 1 byte op codes 0xE0 - 0xFF
+    {
+        plainCount = opCodeLength - 1;
+        copyCount = 0;
+        copyOffset = 0;
+        plain = opCode + 1;
+    }
+    else if (ccbyte1 >= 0xC0) // 4 byte op code 0xC0 - 0xDF
+    {
+        plainCount = (ccbyte1 & 3);
+        copyCount = ((ccbyte1 & 0x0C) << 6) + opCode[3] + 5;
+        copyOffset = (((ccbyte1 & 0x10) << 12) + (opCode[1] << 8)) + opCode[2] + 1;
+        plain = opCode + 4;
+    }
+    else if (ccbyte1 >= 0x80) // 3 byte op code 0x80 - 0xBF
+    {
+        plainCount = (opCode[1] & 0xC0) >> 6;
+        copyCount = (ccbyte1 & 0x3F) + 4;
+        copyOffset = ((opCode[1] & 0x3F) << 8) + opCode[2] + 1;
+        plain = opCode + 3;
+    }
+    else // 2 byte op code 0x00 - 0x7F
+    {
+        plainCount = (ccbyte1 & 3);
+        copyCount = ((ccbyte1 & 0x1C) >> 2) + 3;
+        copyOffset = ((ccbyte1 >> 5) << 8) + opCode[1] + 1;
+        plain = opCode + 2;
+    }
+
+    if ((uncompressedSize - totalOut) < (plainCount + copyCount) ||
+        (copyCount > 0 && copyOffset > (totalOut + plainCount)))
+    {
+        return formatCannotRead;
+    }
+
+    if (!EnsureWindowSpace(plainCount + copyCount))
+    {
+        *windowFull = true;
+        return noErr;
+    }
+
+    BYTE* dst = window.get() + writeIndex;
+
+    if (plainCount > 0)
+    {
+        if (plainCopySlack)
+        {
+            FastCopyPlain(dst, plain, static_cast<int>(plainCount));
+        }
+        else
+        {
+            memcpy(dst, plain, plainCount);
+        }
+        dst += plainCount;
+    }
+
+    if (copyCount > 0)
+    {
+        FastCopyMatch(dst, static_cast<int>(copyOffset), static_cast<int>(copyCount));
+    }
+
+    writeIndex += plainCount + copyCount;
+    totalOut += plainCount + copyCount;
+
+    if (ccbyte1 >= 0xFC || totalOut == uncompressedSize)
     {
-        return e;
+        finished = true;
     }
 
     return noErr;
 }
 
+OSErr QFSStreamDecoder::Feed(const BYTE* data, const DWORD length, DWORD* consumed)
+{
+    DWORD index = 0;
+
+    if (error == noErr && !headerRead)
+    {
+        error = ReadHeader(data, length, &index);
+    }
+
+    while (error == noErr && headerRead && !finished)
+    {
+        const BYTE* opCode;
+        DWORD opCodeLength = 0;
+        bool plainCopySlack;
+
+        if (pendingLength == 0)
+        {
+            opCodeLength = GetOpCodeLength(data + index, length - index);
+        }
+
+        if (pendingLength == 0 && opCodeLength != 0 && opCodeLength <= (length - index))
+        {
+            opCode = data + index;
+            plainCopySlack = (length - index - opCodeLength) >= QfsFastCopyMargin;
+        }
+        else
+        {
+            // The op code is split across calls, collect it in the pending buffer.
+            opCodeLength = GetOpCodeLength(pending, pendingLength);
+
+            while ((opCodeLength == 0 || pendingLength < opCodeLength) && index < length)
+            {
+                pending[pendingLength++] = data[index++];
+                opCodeLength = GetOpCodeLength(pending, pendingLength);
+            }
+
+            if (opCodeLength == 0 || pendingLength < opCodeLength)
+            {
+                break;
+            }
+
+            opCode = pending;
+            plainCopySlack = true;
+        }
+
+        bool windowFull;
+        error = DecodeOpCode(opCode, opCodeLength, plainCopySlack, &windowFull);
+
+        if (error != noErr || windowFull)
+        {
+            break;
+        }
+
+        if (opCode == pending)
+        {
+            pendingLength = 0;
+        }
+        else
+        {
+            index += opCodeLength;
+        }
+    }
+
+    *consumed = index;
+
+    return error;
+}
+
+DWORD QFSStreamDecoder::Drain(BYTE* outData, const DWORD length)
+{
+    DWORD count = writeIndex - readIndex;
+
+    if (count > length)
+    {
+        count = length;
+    }
+
+    if (count > 0)
+    {
+        memcpy(outData, window.get() + readIndex, count);
+        readIndex += count;
+    }
+
+    return count;
+}
+
+bool QFSStreamDecoder::HasHeader() const
+{
+    return headerRead;
+}
+
+bool QFSStreamDecoder::IsFinished() const
+{
+    return finished;
+}
+
+DWORD QFSStreamDecoder::GetUncompressedSize() const
+{
+    return uncompressedSize;
+}
+
 OSErr GetUncompressedSize(const BYTE* inData, const DWORD inLength, int* uncompressedSize)
 {
     *uncompressedSize = 0;
@@ -146,18 +955,13 @@ OSErr GetUncompressedSize(const BYTE* inData, const DWORD inLength, int* uncompr
         return paramErr;
     }
 
-    OSErr err = noErr;
+    QFSHeader header;
+    const OSErr err = header.Read(inData, inLength);
 
-    try
+    if (err == noErr)
     {
-        QFSHeader header(inData, inLength);
-
         *uncompressedSize = header.GetUncompressedSize();
     }
-    catch (const OSErr headerError)
-    {
-        err = headerError;
-    }
 
     return err;
 }
@@ -23,13 +23,84 @@
 #define QFS_H
 
 #include "Common.h"
+#include <memory>
 
+enum QFSCompressionLevel
+{
+	// Short hash chains and greedy parsing.
+	QFSCompressionFast = 0,
+	// Medium hash chains with one step of lazy matching.
+	QFSCompressionNormal = 1,
+	// Long hash chains with one step of lazy matching.
+	QFSCompressionMax = 2
+};
+
+// Compresses the data using the QFS/RefPack format, optionally prefixing the header with the compressed length.
+// compressedLength is set to zero if the compressed data does not fit in outData.
+OSErr QFSCompress(const BYTE* inData,
+				  const DWORD inLength,
+				  BYTE* outData,
+				  const DWORD outLength,
+				  const QFSCompressionLevel level,
+				  const bool prefixCompressedLength,
+				  DWORD* compressedLength);
+
+// Describes where the decompression of a QFS stream failed.
+struct QFSDecompressStatus
+{
+	OSErr error;
+	// The offset of the header or op code that could not be decoded.
+	DWORD inputOffset;
+	// The number of bytes that were decompressed before the error.
+	DWORD outputOffset;
+};
+
+// Decompresses the data, each op code is validated against the remaining input and output.
 OSErr QFSDecompress(const BYTE* inData, const DWORD inLength, BYTE* outData, const DWORD outLength);
+OSErr QFSDecompress(const BYTE* inData, const DWORD inLength, BYTE* outData, const DWORD outLength, QFSDecompressStatus* status);
+
+// Decompresses a QFS stream incrementally, keeping the last 128 KiB of output as the history window.
+class QFSStreamDecoder
+{
+public:
+	QFSStreamDecoder();
+
+	// Decodes the input until it is used up or the window is full of data that has not been drained.
+	// consumed is set to the number of input bytes that were used.
+	OSErr Feed(const BYTE* data, const DWORD length, DWORD* consumed);
+	// Copies up to length decompressed bytes to the output, returns the number of bytes copied.
+	DWORD Drain(BYTE* outData, const DWORD length);
+
+	bool HasHeader() const;
+	// Returns true when the end of the compressed data has been decoded.
+	bool IsFinished() const;
+	DWORD GetUncompressedSize() const;
+
+private:
+	QFSStreamDecoder(const QFSStreamDecoder& copyMe);
+
+	OSErr ReadHeader(const BYTE* data, const DWORD length, DWORD* consumed);
+	bool EnsureWindowSpace(const DWORD count);
+	OSErr DecodeOpCode(const BYTE* opCode, const DWORD opCodeLength, const bool plainCopySlack, bool* windowFull);
+
+	std::unique_ptr<BYTE[]> window;
+	DWORD writeIndex;
+	DWORD readIndex;
+	DWORD totalOut;
+	DWORD uncompressedSize;
+	BYTE headerBytes[16];
+	DWORD headerLength;
+	BYTE pending[128];
+	DWORD pendingLength;
+	bool headerRead;
+	bool finished;
+	OSErr error;
+};
+
 OSErr GetUncompressedSize(const BYTE* inData, const DWORD inLength, int* uncompressedSize);
 OSErr GetUncompressedSize(HANDLE hFile, LONG offset, int* uncompressedSize);
 OSErr IsQFSCompressed(HANDLE hFile, LONG offset, bool* isCompressed);
 
-extern BufferID qfsBufferID;
 extern BYTE* qfsBuffer;
 
 #endif
\ No newline at end of file
@@ -30,11 +30,15 @@ enum QFSHeaderFlags
     QFS_HEADER_FLAG_MASK = ~(QFS_HEADER_FLAG_COMPRESSED_SIZE_PRESENT | QFS_HEADER_FLAG_UNKNOWN | QFS_HEADER_FLAG_LARGE_FILES)
 };
 
-QFSHeader::QFSHeader(const BYTE* data, const DWORD dataLength)
+QFSHeader::QFSHeader() : uncompressedSize(0), dataStartOffset(0)
+{
+}
+
+OSErr QFSHeader::Read(const BYTE* data, const DWORD dataLength)
 {
     if (dataLength < 5)
     {
-        throw (OSErr)formatCannotRead; // Truncated or invalid data.
+        return formatCannotRead; // Truncated or invalid data.
     }
 
     int signatureOffset;
@@ -46,13 +50,13 @@ QFSHeader::QFSHeader(const BYTE* data, const DWORD dataLength)
     }
     else
     {
-        if ((data[4] & QFS_HEADER_FLAG_MASK) == 0x10 && data[5] == 0xFB)
+        if (dataLength > 5 && (data[4] & QFS_HEADER_FLAG_MASK) == 0x10 && data[5] == 0xFB)
         {
             signatureOffset = 4;
         }
         else
         {
-            throw (OSErr)formatCannotRead; // Unknown compression format.
+            return formatCannotRead; // Unknown compression format.
         }
     }
 
@@ -78,7 +82,7 @@ QFSHeader::QFSHeader(const BYTE* data, const DWORD dataLength)
 
     if (static_cast<DWORD>(dataStartOffset) >= dataLength)
     {
-        throw (OSErr)formatCannotRead; // Truncated or invalid data.
+        return formatCannotRead; // Truncated or invalid data.
     }
 
     if (largeFileLength)
@@ -89,6 +93,8 @@ QFSHeader::QFSHeader(const BYTE* data, const DWORD dataLength)
     {
         uncompressedSize = ((data[index] << 16) | (data[index + 1] << 8) | data[index + 2]);
     }
+
+    return noErr;
 }
 
 QFSHeader::QFSHeader(const HANDLE hFile, const LONG offset)
@@ -115,7 +121,7 @@ QFSHeader::QFSHeader(const HANDLE hFile, const LONG offset)
     }
     else
     {
-        error = SetFilePosition(hFile, FILE_CURRENT, 4);
+        error = SetFilePosition(hFile, FILE_BEGIN, offset + 4);
         if (error != noErr)
         {
             throw error;
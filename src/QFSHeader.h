@@ -27,9 +27,13 @@
 class QFSHeader
 {
 public:
-	QFSHeader(const BYTE* data, const DWORD dataLength);
+	QFSHeader();
+	// Throws an OSErr when the header cannot be read or is not valid.
 	QFSHeader(const HANDLE hFile, const LONG offset);
 
+	// Parses the header at the start of the data, returns formatCannotRead if it is truncated or invalid.
+	OSErr Read(const BYTE* data, const DWORD dataLength);
+
 	static bool CheckSignature(const BYTE (&data)[2]);
 
 	int GetDataStartOffset() const;
@@ -20,103 +20,79 @@
 */
 
 #include "FshFormatPS.h"
+#include "FshArchiveIndex.h"
+#include "FshCodec.h"
 #include "FileIo.h"
 #include "QFS.h"
+#include "Utilities.h"
 #include "ui.h"
-#include "squish.h"
 
 BufferID outBufferID;
 void* outData = nullptr;
 
-static OSErr GetDataSize(HANDLE hFile, const FshDirEntry& dir, const FshBmpEntry& entry, int* dataSize)
-{
-    OSErr e = noErr;
+// The DXT and packed 16-bit formats are decoded into a buffer of this many rows at a time,
+// DoReadContinue hands each band to the host.
+static const int DecodeBandHeight = 64;
 
-    if ((entry.code & 0x80) != 0)
-    {
-        const LONG offset = static_cast<LONG>(dir.offset + sizeof(FshBmpEntry));
+struct BandDecodeState
+{
+	FshBmpType code;
+	int width;
+	int height;
+	int nextRow;
+	// The image data, either in the mapped or decompressed file or in sourceBuffer.
+	const BYTE* source;
+	void* sourceBuffer;
+};
+
+static BandDecodeState bandState;
+
+static void DecodeNextBand(FormatRecordPtr pb)
+{
+    const int top = bandState.nextRow;
+    const int remaining = bandState.height - top;
+    const int rows = remaining < DecodeBandHeight ? remaining : DecodeBandHeight;
 
-        bool compressed = false;
+    DecodeFshImage(bandState.code,
+                   bandState.width,
+                   rows,
+                   bandState.source + GetFshImageRowOffset(bandState.code, bandState.width, top),
+                   static_cast<BYTE*>(outData));
 
-        e = IsQFSCompressed(hFile, offset, &compressed);
+    SETRECT(pb->theRect, 0, top, bandState.width, top + rows);
+    pb->data = outData;
 
-        if (e == noErr)
-        {
-            if (compressed)
-            {
-                e = GetUncompressedSize(hFile, offset, dataSize);
-            }
-            else
-            {
-                e = formatCannotRead; // Unknown compression format
-            }
-        }
-    }
-    else
-    {
-        *dataSize = GetImageDataSize(entry.width, entry.height, static_cast<FshBmpType>(entry.code & 0x7F));
-
-        if (*dataSize == 0)
-        {
-            e = formatCannotRead; // Unsupported image format
-        }
-    }
-
-    return e;
+    bandState.nextRow = top + rows;
 }
 
-static OSErr ReadFsh(FormatRecordPtr pb, const FshHeader& header, const FshDirEntry& dir, const FshBmpEntry& entry)
+static OSErr ReadFsh(FormatRecordPtr pb, const FshArchiveIndex& index, const int entryIndex, const FshBmpEntry& entry)
 {
     int dataSize;
 
-    OSErr e = GetDataSize(reinterpret_cast<HANDLE>(pb->dataFork), dir, entry, &dataSize);
+    OSErr e = GetFshImageDataSize(index, entryIndex, entry, &dataSize);
 
-    if (e == noErr)
-    {
-        BufferID temp = nullptr;
-        void* tempData = nullptr;
+    const FshBmpType code = static_cast<FshBmpType>(entry.code & 0x7f);
 
-        const FshBmpType code = static_cast<FshBmpType>(entry.code & 0x7f);
-
-        if (code == DXT1 || code == DXT3)
-        {
-            e = pb->bufferProcs->allocateProc(dataSize, &temp);
-
-            if (e == noErr)
-            {
-                tempData = pb->bufferProcs->lockProc(temp, FALSE);
-                e = ReadFshImageData(pb, header, dir, entry, tempData, dataSize);
+    // The decoders read the full image, so a compressed entry that holds less data than that is invalid.
+    if (e == noErr && dataSize < GetImageDataSize(entry.width, entry.height, code))
+    {
+        e = formatCannotRead;
+    }
 
-                if (e == noErr)
-                {
-                    e = pb->bufferProcs->allocateProc((entry.width * entry.height * 4), &outBufferID);
+    // Uncompressed image data is read directly from the memory mapped or decompressed file.
+    const void* view = nullptr;
 
-                    if (e == noErr)
-                    {
-                        pb->data = outData = reinterpret_cast<BYTE*>(pb->bufferProcs->lockProc(outBufferID, FALSE));
+    if (e == noErr)
+    {
+        e = GetFshImageDataView(index, entryIndex, entry, dataSize, &view);
+    }
 
-                        int flags = 0;
-                        switch (code)
-                        {
-                        case DXT1:
-                                flags |= squish::kDxt1;
-                            break;
-                        case DXT3:
-                                flags |= squish::kDxt3;
-                            break;
-                        }
+    if (e == noErr)
+    {
+        BufferSuiteAllocator allocator(pb);
+        const void* imageData = view;
 
-                        squish::DecompressImage(
-                            reinterpret_cast<squish::u8*>(outData),
-                            static_cast<int>(entry.width),
-                            static_cast<int>(entry.height),
-                            tempData,
-                            flags);
-                    }
-                }
-            }
-        }
-        else if (code == TwentyFourBit || code == ThirtyTwoBit)
+        if (code == TwentyFourBit || code == ThirtyTwoBit)
         {
             // Set the plane map to BGRA
             pb->planeMap[0] = 2; // B
@@ -124,107 +100,56 @@ static OSErr ReadFsh(FormatRecordPtr pb, const FshHeader& header, const FshDirEn
             pb->planeMap[2] = 0; // R
             pb->planeMap[3] = 3; // A
 
-            e = pb->bufferProcs->allocateProc(dataSize, &outBufferID);
-
-            if (e == noErr)
+            if (imageData != nullptr)
+            {
+                // The host only reads from the data pointer.
+                pb->data = const_cast<void*>(imageData);
+            }
+            else
             {
-                pb->data = outData = reinterpret_cast<BYTE*>(pb->bufferProcs->lockProc(outBufferID, FALSE));
-                e = ReadFshImageData(pb, header, dir, entry, outData, dataSize);
+                e = pb->bufferProcs->allocateProc(dataSize, &outBufferID);
+
+                if (e == noErr)
+                {
+                    pb->data = outData = reinterpret_cast<BYTE*>(pb->bufferProcs->lockProc(outBufferID, FALSE));
+                    e = ReadFshImageData(allocator, index, entryIndex, entry, outData, dataSize);
+                }
             }
         }
-        else // the packed 16-bit formats
+        else // the DXT and packed 16-bit formats
         {
-            e = pb->bufferProcs->allocateProc(dataSize, &temp);
-
-            if (e == noErr)
+            if (imageData == nullptr)
             {
-                tempData = pb->bufferProcs->lockProc(temp, FALSE);
-
-                e = ReadFshImageData(pb, header, dir, entry, tempData, dataSize);
+                e = allocator.Allocate(static_cast<DWORD>(dataSize), &bandState.sourceBuffer);
 
                 if (e == noErr)
                 {
-                    e = pb->bufferProcs->allocateProc((pb->rowBytes * entry.height), &outBufferID);
-
-                    if (e == noErr)
-                    {
-                        pb->data = outData = pb->bufferProcs->lockProc(outBufferID, FALSE);
-                        BYTE* destPtr = reinterpret_cast<BYTE*>(outData);
-
-                        if (code == SixteenBit) // 16-bit RGB (0:5:6:5)
-                        {
-                            const UINT16* sPtr = static_cast<UINT16*>(tempData);
-
-                            for (int y = 0; y < entry.height; y++)
-                            {
-                                const UINT16* src = sPtr + (y * entry.width);
-                                BYTE* p = destPtr + (y * pb->rowBytes);
-
-                                for (int x = 0; x < entry.width; x++)
-                                {
-                                    p[0] = (((src[0] >> 11) & 0x1f) << 3);
-                                    p[1] = (((src[0] >> 5) & 0x3f) << 2);
-                                    p[2] = ((src[0] & 0x1f) << 3);
-
-                                    src++;
-                                    p += 3;
-                                }
-
-                            }
-                        }
-                        else if (code == SixteenBitAlpha) // 16-bit ARGB (1:5:5:5)
-                        {
-                            const UINT16* sPtr = static_cast<UINT16*>(tempData);
+                    imageData = bandState.sourceBuffer;
 
-                            for (int y = 0; y < entry.height; y++)
-                            {
-                                const UINT16* src = sPtr + (y * entry.width);
-                                BYTE* p = destPtr + (y * pb->rowBytes);
+                    e = ReadFshImageData(allocator, index, entryIndex, entry, bandState.sourceBuffer, dataSize);
+                }
+            }
 
-                                for (int x = 0; x < entry.width; x++)
-                                {
-                                    p[0] = (((src[0] >> 10) & 0x1f) << 3);
-                                    p[1] = (((src[0] >> 5) & 0x1f) << 3);
-                                    p[2] = ((src[0] & 0x1f) << 3);
-                                    p[3] = ((src[0] & 0x8000) != 0) ? 255 : 0;
+            if (e == noErr)
+            {
+                const int bandHeight = entry.height < DecodeBandHeight ? entry.height : DecodeBandHeight;
 
-                                    src++;
-                                    p += 4;
-                                }
-                            }
-                        }
-                        else if (code == SixteenBit4x4) // 16-bit ARGB (4:4:4:4)
-                        {
-                            const BYTE* ptr = static_cast<BYTE*>(tempData);
-                            const int srcStride = entry.width * 2;
+                e = pb->bufferProcs->allocateProc((pb->rowBytes * bandHeight), &outBufferID);
 
-                            for (int y = 0; y < entry.height; y++)
-                            {
-                                const BYTE* src = ptr + (y * srcStride);
-                                BYTE* p = destPtr + (y * pb->rowBytes);
+                if (e == noErr)
+                {
+                    outData = pb->bufferProcs->lockProc(outBufferID, FALSE);
 
-                                for (int x = 0; x < entry.width; x++)
-                                {
-                                    p[0] = ((src[1] & 15) * 0x11);
-                                    p[1] = ((src[0] >> 4) * 0x11);
-                                    p[2] = ((src[0] & 15) * 0x11);
-                                    p[3] = ((src[1] >> 4) * 0x11);
+                    bandState.code = code;
+                    bandState.width = entry.width;
+                    bandState.height = entry.height;
+                    bandState.nextRow = 0;
+                    bandState.source = static_cast<const BYTE*>(imageData);
 
-                                    src += 2;
-                                    p += 4;
-                                }
-                            }
-                        }
-                    }
+                    DecodeNextBand(pb);
                 }
             }
         }
-
-        if (tempData != nullptr)
-        {
-            pb->bufferProcs->unlockProc(temp);
-            pb->bufferProcs->freeProc(temp);
-        }
     }
 
     return e;
@@ -245,23 +170,37 @@ OSErr DoReadStart(FormatRecordPtr pb)
     HANDLE hFile = reinterpret_cast<HANDLE>(pb->dataFork);
     qfsBuffer = nullptr;
     outData = nullptr;
+    ZeroMemory(&bandState, sizeof(bandState));
 
-    e = DecompressFsh(pb, hFile);
+    BufferSuiteAllocator allocator(pb);
+
+    e = DecompressFsh(allocator, hFile);
 
     if (e == noErr)
     {
-        FshHeader header;
-        e = ReadFshHeader(hFile, &header);
+        if (qfsBuffer == nullptr)
+        {
+            // The mapping is optional, the readers fall back to the file if it fails.
+            MapFsh(hFile);
+        }
+
+        FshArchiveIndex index;
+        e = index.Load(hFile);
 
         if (e == noErr)
         {
-            e = CheckFshBmpTypes(hFile, header);
+            // Checking every image of a compressed file would decompress all of it,
+            // only the image that is loaded is checked.
+            if (qfsBuffer == nullptr)
+            {
+                e = CheckFshBmpTypes(index);
+            }
 
             if (e == noErr)
             {
                 int fshIndex = 0;
 
-                if (pb->revertInfo != nullptr || header.numBmps == 1 || LoadFshDlg(pb, header, &fshIndex))
+                if (pb->revertInfo != nullptr || index.GetEntryCount() == 1 || LoadFshDlg(pb, index, &fshIndex))
                 {
                     RevertInfo* rev = nullptr;
 
@@ -277,24 +216,33 @@ OSErr DoReadStart(FormatRecordPtr pb)
                     pb->imageMode = plugInModeRGBColor;
                     pb->depth = 8;
 
-                    FshDirEntry dir;
-                    e = ReadFshDir(hFile, fshIndex, &dir);
+                    if (fshIndex < 0 || fshIndex >= index.GetEntryCount())
+                    {
+                        e = formatCannotRead;
+                    }
 
                     if (e == noErr)
                     {
+                        const FshDirEntry& dir = index.GetDirEntry(fshIndex);
+
                         FshBmpEntry entry;
-                        e = ReadFshEntryDir(hFile, dir, &entry);
+                        e = index.GetBmpEntry(fshIndex, &entry);
+
+                        if (e == noErr && !IsSupportedFshBmpType(static_cast<FshBmpType>(entry.code & 0x7f)))
+                        {
+                            e = formatCannotRead;
+                        }
 
                         if (e == noErr)
                         {
                             int mipCount;
                             bool mipPacked;
 
-                            e = CountEntryMipMaps(hFile, header, dir, entry, &mipCount, &mipPacked);
+                            e = index.GetMipCount(fshIndex, &mipCount, &mipPacked);
                             if (e == noErr)
                             {
                                 const FshBmpType code = static_cast<FshBmpType>(entry.code & 0x7f);
-                                const bool hasAlpha = (code == DXT1 || code == DXT3 || code == ThirtyTwoBit || code == SixteenBitAlpha || code == SixteenBit4x4);
+                                const bool hasAlpha = GetFshBmpChannelCount(code) == 4;
 
                                 pb->imageSize.h = entry.width;
                                 pb->imageSize.v = entry.height;
@@ -320,7 +268,7 @@ OSErr DoReadStart(FormatRecordPtr pb)
 
                                 SETRECT(pb->theRect, 0, 0, entry.width, entry.height);
 
-                                e = ReadFsh(pb, header, dir, entry);
+                                e = ReadFsh(pb, index, fshIndex, entry);
 
                                 if (e == noErr && pb->revertInfo == nullptr)
                                 {
@@ -329,11 +277,13 @@ OSErr DoReadStart(FormatRecordPtr pb)
                                     {
                                         rev = reinterpret_cast<RevertInfo*>(pb->handleProcs->lockProc(pb->revertInfo, FALSE));
                                         rev->fshCode = code;
-                                        memcpy(rev->headerDir, header.dirID, 4);
+                                        memcpy(rev->headerDir, index.GetHeader().dirID, 4);
                                         memcpy(rev->entryDir, dir.name, 4);
                                         rev->mipCount = mipCount;
                                         rev->mipPacked = mipPacked;
                                         rev->loadIndex = fshIndex;
+                                        rev->qfsCompressed = qfsBuffer != nullptr;
+                                        rev->qfsEntryCompressed = (entry.code & 0x80) != 0;
                                     }
                                 }
                             }
@@ -364,7 +314,14 @@ OSErr DoReadStart(FormatRecordPtr pb)
 
 OSErr DoReadContinue(FormatRecordPtr pb)
 {
-    pb->data = nullptr;
+    if (bandState.source != nullptr && bandState.nextRow < bandState.height)
+    {
+        DecodeNextBand(pb);
+    }
+    else
+    {
+        pb->data = nullptr;
+    }
 
     return noErr;
 }
@@ -378,12 +335,16 @@ OSErr DoReadFinish(FormatRecordPtr pb)
         outData = nullptr;
     }
 
-    if (qfsBuffer != nullptr)
+    BufferSuiteAllocator allocator(pb);
+
+    if (bandState.sourceBuffer != nullptr)
     {
-        pb->bufferProcs->unlockProc(qfsBufferID);
-        pb->bufferProcs->freeProc(qfsBufferID);
-        qfsBuffer = nullptr;
+        allocator.Free(bandState.sourceBuffer);
     }
+    ZeroMemory(&bandState, sizeof(bandState));
+
+    FreeDecompressedFsh(allocator);
+    UnmapFsh();
 
     return noErr;
 }
\ No newline at end of file
@@ -106,7 +106,7 @@ Boolean ReadScriptParamsOnWrite(FormatRecordPtr pb, Globals* globals, OSErr* err
 {
     DescriptorKeyID				key = 0;
     DescriptorTypeID			type = 0;
-    DescriptorKeyIDArray		array = { keyFshFormat, keyHeaderDirID, keyEntryDirName, keyFshWriteComp, keyMipCount, keyMipPacked, NULLID };
+    DescriptorKeyIDArray		array = { keyFshFormat, keyHeaderDirID, keyEntryDirName, keyFshWriteComp, keyMipCount, keyMipPacked, keyQfsCompression, keyQfsCompressionLevel, keyQfsEntryCompression, NULLID };
     int32						flags = 0;
 
     *error = noErr;
@@ -122,6 +122,7 @@ Boolean ReadScriptParamsOnWrite(FormatRecordPtr pb, Globals* globals, OSErr* err
             DescriptorEnumID format;
             Boolean b;
             int32 temp;
+            double d;
 
             while (readProcs->getKeyProc(token, &key, &type, &flags))
             {
@@ -176,6 +177,48 @@ Boolean ReadScriptParamsOnWrite(FormatRecordPtr pb, Globals* globals, OSErr* err
                         globals->mipPacked = (b != 0);
                     }
                     break;
+                case keyMipFilter:
+                    if (readProcs->getPinnedIntegerProc(token, MipFilterBox, MipFilterGammaCorrect, &temp) == noErr)
+                    {
+                        globals->mipFilter = static_cast<MipFilter>(temp);
+                    }
+                    break;
+                case keyQfsCompression:
+                    if (readProcs->getBooleanProc(token, &b) == noErr)
+                    {
+                        globals->qfsCompression = (b != 0);
+                    }
+                    break;
+                case keyQfsCompressionLevel:
+                    if (readProcs->getPinnedIntegerProc(token, QFSCompressionFast, QFSCompressionMax, &temp) == noErr)
+                    {
+                        globals->qfsCompressionLevel = static_cast<QFSCompressionLevel>(temp);
+                    }
+                    break;
+                case keyQfsEntryCompression:
+                    if (readProcs->getBooleanProc(token, &b) == noErr)
+                    {
+                        globals->qfsEntryCompression = (b != 0);
+                    }
+                    break;
+                case keyDxtQuality:
+                    if (readProcs->getPinnedIntegerProc(token, DxtQualityFastest, DxtQualityBest, &temp) == noErr)
+                    {
+                        globals->dxtQuality = static_cast<DxtCompressionQuality>(temp);
+                    }
+                    break;
+                case keyDxtPerceptualMetric:
+                    if (readProcs->getBooleanProc(token, &b) == noErr)
+                    {
+                        globals->dxtPerceptualMetric = (b != 0);
+                    }
+                    break;
+                case keyDxtTargetError:
+                    if (readProcs->getFloatProc(token, &d) == noErr && d >= 0.0)
+                    {
+                        globals->dxtTargetError = static_cast<float>(d);
+                    }
+                    break;
                 }
 
             }
@@ -266,6 +309,19 @@ OSErr WriteScriptParamsOnWrite(FormatRecordPtr pb, const Globals *globals)
             {
                 writeProcs->putBooleanProc(token, keyFshWriteComp, FALSE);
             }
+            else
+            {
+                writeProcs->putIntegerProc(token, keyDxtQuality, globals->dxtQuality);
+                if (globals->dxtPerceptualMetric)
+                {
+                    writeProcs->putBooleanProc(token, keyDxtPerceptualMetric, TRUE);
+                }
+                if (globals->dxtTargetError > 0.0f)
+                {
+                    const double targetError = globals->dxtTargetError;
+                    writeProcs->putFloatProc(token, keyDxtTargetError, &targetError);
+                }
+            }
 
             if (globals->mipCount > 0)
             {
@@ -274,6 +330,25 @@ OSErr WriteScriptParamsOnWrite(FormatRecordPtr pb, const Globals *globals)
                 {
                     writeProcs->putBooleanProc(token, keyMipPacked, TRUE);
                 }
+                if (globals->mipFilter != MipFilterBox)
+                {
+                    writeProcs->putIntegerProc(token, keyMipFilter, globals->mipFilter);
+                }
+            }
+
+            if (globals->qfsCompression)
+            {
+                writeProcs->putBooleanProc(token, keyQfsCompression, TRUE);
+            }
+
+            if (globals->qfsEntryCompression)
+            {
+                writeProcs->putBooleanProc(token, keyQfsEntryCompression, TRUE);
+            }
+
+            if (globals->qfsCompression || globals->qfsEntryCompression)
+            {
+                writeProcs->putIntegerProc(token, keyQfsCompressionLevel, globals->qfsCompressionLevel);
             }
 
             pb->handleProcs->disposeProc(pb->descriptorParameters->descriptor);
@@ -0,0 +1,328 @@
+/*
+*  This file is part of FshFormat, a file format plug-in for Adobe Photoshop(R)
+*  that loads and saves FSH images.
+*
+*  Copyright (C) 2011, 2012, 2013, 2014, 2015, 2022, 2023 Nicholas Hayes
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+
+#ifndef SIXTEENBITPIXELS_H
+#define SIXTEENBITPIXELS_H
+
+// The conversions between 8-bit pixels and the 16-bit FSH formats. Each format has a scalar Pixel function
+// and an SSE2 Pixels function that converts eight pixels at a time with the same results.
+
+#include "Common.h"
+#include <string.h>
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FSHCODEC_USE_SSE2 1
+#include <emmintrin.h>
+#else
+#define FSHCODEC_USE_SSE2 0
+#endif
+
+#if FSHCODEC_USE_SSE2
+// Interleaves eight pixels of 8-bit channel values held in 16-bit lanes into two vectors of RGBA pixels.
+static inline void InterleaveRgba(__m128i r, __m128i g, __m128i b, __m128i a, __m128i* low, __m128i* high)
+{
+    const __m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+    const __m128i ba = _mm_or_si128(b, _mm_slli_epi16(a, 8));
+
+    *low = _mm_unpacklo_epi16(rg, ba);
+    *high = _mm_unpackhi_epi16(rg, ba);
+}
+
+// Removes the fourth byte of four RGBX pixels, leaving 12 bytes of RGB pixels at the start of the vector.
+static inline __m128i RemovePaddingByte(__m128i v)
+{
+    // Join the two pixels in each 64-bit half.
+    const __m128i first = _mm_and_si128(v, _mm_set_epi32(0, 0x00ffffff, 0, 0x00ffffff));
+    const __m128i second = _mm_and_si128(v, _mm_set_epi32(0x00ffffff, 0, 0x00ffffff, 0));
+    v = _mm_or_si128(first, _mm_srli_epi64(second, 8));
+
+    // Move the 6 bytes of the upper half down next to the lower half.
+    const __m128i lowerHalf = _mm_and_si128(v, _mm_set_epi32(0, 0, 0x0000ffff, -1));
+    const __m128i upperHalf = _mm_and_si128(_mm_srli_si128(v, 2), _mm_set_epi32(0, -1, static_cast<int>(0xffff0000), 0));
+
+    return _mm_or_si128(lowerHalf, upperHalf);
+}
+#endif // FSHCODEC_USE_SSE2
+
+// 16-bit RGB (0:5:6:5)
+struct Unpack565
+{
+    static const int Channels = 3;
+
+    static void Pixel(const UINT16* src, BYTE* p)
+    {
+        p[0] = (((src[0] >> 11) & 0x1f) << 3);
+        p[1] = (((src[0] >> 5) & 0x3f) << 2);
+        p[2] = ((src[0] & 0x1f) << 3);
+    }
+
+#if FSHCODEC_USE_SSE2
+    static void Pixels(__m128i v, __m128i* low, __m128i* high)
+    {
+        const __m128i r = _mm_and_si128(_mm_srli_epi16(v, 8), _mm_set1_epi16(0xf8));
+        const __m128i g = _mm_and_si128(_mm_srli_epi16(v, 3), _mm_set1_epi16(0xfc));
+        const __m128i b = _mm_and_si128(_mm_slli_epi16(v, 3), _mm_set1_epi16(0xf8));
+
+        InterleaveRgba(r, g, b, _mm_setzero_si128(), low, high);
+    }
+#endif // FSHCODEC_USE_SSE2
+};
+
+// 16-bit ARGB (1:5:5:5)
+struct Unpack1555
+{
+    static const int Channels = 4;
+
+    static void Pixel(const UINT16* src, BYTE* p)
+    {
+        p[0] = (((src[0] >> 10) & 0x1f) << 3);
+        p[1] = (((src[0] >> 5) & 0x1f) << 3);
+        p[2] = ((src[0] & 0x1f) << 3);
+        p[3] = ((src[0] & 0x8000) != 0) ? 255 : 0;
+    }
+
+#if FSHCODEC_USE_SSE2
+    static void Pixels(__m128i v, __m128i* low, __m128i* high)
+    {
+        const __m128i r = _mm_and_si128(_mm_srli_epi16(v, 7), _mm_set1_epi16(0xf8));
+        const __m128i g = _mm_and_si128(_mm_srli_epi16(v, 2), _mm_set1_epi16(0xf8));
+        const __m128i b = _mm_and_si128(_mm_slli_epi16(v, 3), _mm_set1_epi16(0xf8));
+        const __m128i a = _mm_and_si128(_mm_srai_epi16(v, 15), _mm_set1_epi16(0xff));
+
+        InterleaveRgba(r, g, b, a, low, high);
+    }
+#endif // FSHCODEC_USE_SSE2
+};
+
+// 16-bit ARGB (4:4:4:4)
+struct Unpack4444
+{
+    static const int Channels = 4;
+
+    static void Pixel(const UINT16* pixel, BYTE* p)
+    {
+        const BYTE* src = reinterpret_cast<const BYTE*>(pixel);
+
+        p[0] = ((src[1] & 15) * 0x11);
+        p[1] = ((src[0] >> 4) * 0x11);
+        p[2] = ((src[0] & 15) * 0x11);
+        p[3] = ((src[1] >> 4) * 0x11);
+    }
+
+#if FSHCODEC_USE_SSE2
+    static void Pixels(__m128i v, __m128i* low, __m128i* high)
+    {
+        const __m128i nibble = _mm_set1_epi16(0xf);
+        const __m128i scale = _mm_set1_epi16(0x11);
+
+        const __m128i r = _mm_mullo_epi16(_mm_and_si128(_mm_srli_epi16(v, 8), nibble), scale);
+        const __m128i g = _mm_mullo_epi16(_mm_and_si128(_mm_srli_epi16(v, 4), nibble), scale);
+        const __m128i b = _mm_mullo_epi16(_mm_and_si128(v, nibble), scale);
+        const __m128i a = _mm_mullo_epi16(_mm_srli_epi16(v, 12), scale);
+
+        InterleaveRgba(r, g, b, a, low, high);
+    }
+#endif // FSHCODEC_USE_SSE2
+};
+
+template <typename Unpacker>
+static inline void UnpackPixels(const UINT16* src, const int count, BYTE* dst)
+{
+    int i = 0;
+
+#if FSHCODEC_USE_SSE2
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i low;
+        __m128i high;
+        Unpacker::Pixels(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src)), &low, &high);
+
+        if (Unpacker::Channels == 4)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), low);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16), high);
+        }
+        else
+        {
+            // Store the 24 bytes of RGB pixels without writing past them.
+            low = RemovePaddingByte(low);
+            high = RemovePaddingByte(high);
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_or_si128(low, _mm_slli_si128(high, 12)));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + 16), _mm_srli_si128(high, 4));
+        }
+
+        src += 8;
+        dst += 8 * Unpacker::Channels;
+    }
+#endif // FSHCODEC_USE_SSE2
+
+    for (; i < count; i++)
+    {
+        Unpacker::Pixel(src, dst);
+
+        src++;
+        dst += Unpacker::Channels;
+    }
+}
+
+#if FSHCODEC_USE_SSE2
+// Loads four pixels into 32-bit lanes with red in the low byte.
+// When colBytes is 3 the top byte of each lane is the red channel of the next pixel.
+static inline __m128i LoadFourPixels(const BYTE* src, const int colBytes)
+{
+    if (colBytes == 4)
+    {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    }
+
+    int pixels[4];
+    for (int i = 0; i < 4; i++)
+    {
+        memcpy(&pixels[i], src + (i * colBytes), sizeof(int));
+    }
+
+    const __m128i low = _mm_unpacklo_epi32(_mm_cvtsi32_si128(pixels[0]), _mm_cvtsi32_si128(pixels[1]));
+    const __m128i high = _mm_unpacklo_epi32(_mm_cvtsi32_si128(pixels[2]), _mm_cvtsi32_si128(pixels[3]));
+
+    return _mm_unpacklo_epi64(low, high);
+}
+
+// Narrows the low 16 bits of each 32-bit lane, the sign extension keeps the signed saturation from changing them.
+static inline __m128i PackLow16(__m128i a, __m128i b)
+{
+    a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+    b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+
+    return _mm_packs_epi32(a, b);
+}
+#endif // FSHCODEC_USE_SSE2
+
+// 16-bit RGB (0:5:6:5)
+struct Pack565
+{
+    static UINT16 Pixel(const BYTE* src)
+    {
+        return static_cast<UINT16>(((src[0] >> 3) << 11) + ((src[1] >> 2) << 5) + (src[2] >> 3));
+    }
+
+#if FSHCODEC_USE_SSE2
+    static __m128i Pixels(__m128i v)
+    {
+        const __m128i r = _mm_slli_epi32(_mm_and_si128(v, _mm_set1_epi32(0xf8)), 8);
+        const __m128i g = _mm_srli_epi32(_mm_and_si128(v, _mm_set1_epi32(0xfc00)), 5);
+        const __m128i b = _mm_and_si128(_mm_srli_epi32(v, 19), _mm_set1_epi32(0x1f));
+
+        return _mm_or_si128(_mm_or_si128(r, g), b);
+    }
+#endif // FSHCODEC_USE_SSE2
+};
+
+// 16-bit ARGB (1:5:5:5)
+struct Pack1555
+{
+    static UINT16 Pixel(const BYTE* src)
+    {
+        if (src[3] >= 128)
+        {
+            return static_cast<UINT16>((((src[0] >> 3) << 10) + ((src[1] >> 3) << 5) + (src[2] >> 3)) | 0x8000);
+        }
+
+        return 0;
+    }
+
+#if FSHCODEC_USE_SSE2
+    static __m128i Pixels(__m128i v)
+    {
+        // The alpha threshold of 128 is the top bit of the lane.
+        const __m128i opaque = _mm_srai_epi32(v, 31);
+
+        const __m128i r = _mm_slli_epi32(_mm_and_si128(v, _mm_set1_epi32(0xf8)), 7);
+        const __m128i g = _mm_srli_epi32(_mm_and_si128(v, _mm_set1_epi32(0xf800)), 6);
+        const __m128i b = _mm_and_si128(_mm_srli_epi32(v, 19), _mm_set1_epi32(0x1f));
+        const __m128i packed = _mm_or_si128(_mm_or_si128(r, g), _mm_or_si128(b, _mm_set1_epi32(0x8000)));
+
+        return _mm_and_si128(packed, opaque);
+    }
+#endif // FSHCODEC_USE_SSE2
+};
+
+// 16-bit ARGB (4:4:4:4)
+struct Pack4444
+{
+    static UINT16 Pixel(const BYTE* src)
+    {
+        if (src[3] > 0)
+        {
+            return static_cast<UINT16>(((src[0] >> 4) << 8) + ((src[1] >> 4) << 4) + (src[2] >> 4) + ((src[3] >> 4) << 12));
+        }
+
+        return 0;
+    }
+
+#if FSHCODEC_USE_SSE2
+    static __m128i Pixels(__m128i v)
+    {
+        const __m128i transparent = _mm_cmpeq_epi32(_mm_srli_epi32(v, 24), _mm_setzero_si128());
+
+        const __m128i r = _mm_slli_epi32(_mm_and_si128(v, _mm_set1_epi32(0xf0)), 4);
+        const __m128i g = _mm_srli_epi32(_mm_and_si128(v, _mm_set1_epi32(0xf000)), 8);
+        const __m128i b = _mm_and_si128(_mm_srli_epi32(v, 20), _mm_set1_epi32(0xf));
+        const __m128i a = _mm_and_si128(_mm_srli_epi32(v, 16), _mm_set1_epi32(0xf000));
+        const __m128i packed = _mm_or_si128(_mm_or_si128(r, g), _mm_or_si128(b, a));
+
+        return _mm_andnot_si128(transparent, packed);
+    }
+#endif // FSHCODEC_USE_SSE2
+};
+
+template <typename Packer>
+static inline void PackRow(const BYTE* src, const int colBytes, const int width, UINT16* dst)
+{
+    int x = 0;
+
+#if FSHCODEC_USE_SSE2
+    // The 32-bit loads read one byte past a 3-byte pixel, so the scalar loop packs the last pixel of those rows.
+    const int vectorWidth = colBytes >= 4 ? width : width - 1;
+
+    for (; x + 8 <= vectorWidth; x += 8)
+    {
+        const __m128i low = Packer::Pixels(LoadFourPixels(src, colBytes));
+        const __m128i high = Packer::Pixels(LoadFourPixels(src + (4 * colBytes), colBytes));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), PackLow16(low, high));
+
+        src += 8 * colBytes;
+        dst += 8;
+    }
+#endif // FSHCODEC_USE_SSE2
+
+    for (; x < width; x++)
+    {
+        *dst = Packer::Pixel(src);
+
+        src += colBytes;
+        dst++;
+    }
+}
+
+#endif // !SIXTEENBITPIXELS_H
@@ -21,12 +21,10 @@
 
 #include "Utilities.h"
 #include "FshFormatPS.h"
-#include <PIChannelPortsSuite.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
-
-#define RequiredChannelPortsVersion 1
-#define RequiredChannelPortsCount   3
+#include <string.h>
 
 #define RequiredBufferProcsVersion  2
 #define RequiredBufferProcsCount    5
@@ -40,52 +38,6 @@
 #define RequiredHandleProcsVersion  1
 #define RequiredHandleProcsCount    6
 
-// From Photoshop 6 SDK PIUtilities.cpp
-static Boolean HostChannelPortAvailable (ChannelPortProcs *procs, Boolean *outNewerVersion)
-{
-    Boolean available = TRUE;		// assume procs are available
-    Boolean newerVersion = FALSE;	// assume we're running under correct version
-
-    // We want to check for this stuff in a logical order, going from things
-    // that should always be present to things that "may" be present.  It's
-    // always a danger checking things that "may" be present because some
-    // hosts may not leave them NULL if unavailable, instead pointing to
-    // other structures to save space.  So first we'll check the main
-    // proc pointer, then the version, the number of routines, then some
-    // of the actual routines:
-
-    if (procs == nullptr)
-    {
-        available = FALSE;
-    }
-    else if (procs->channelPortProcsVersion < RequiredChannelPortsVersion)
-    {
-        available = FALSE;
-    }
-    else if (procs->channelPortProcsVersion > RequiredChannelPortsVersion)
-    {
-        available = FALSE;
-        newerVersion = TRUE;
-    }
-    else if (procs->numChannelPortProcs < RequiredChannelPortsCount)
-    {
-        available = FALSE;
-    }
-    else if (procs->readPixelsProc == nullptr ||
-             procs->writeBasePixelsProc == nullptr ||
-             procs->readPortForWritePortProc == nullptr)
-    {
-        available = FALSE;
-    }
-
-    if (newerVersion && outNewerVersion != nullptr)
-        *outNewerVersion = newerVersion;
-
-    return available;
-
-} // end HostChannelPortAvailable
-
-
 //-------------------------------------------------------------------------------
 //
 //	HostBufferProcsAvailable
@@ -352,79 +304,72 @@ static Boolean HostHandleProcsAvailable (HandleProcs *procs, Boolean *outNewerVe
 
 } // end HostHandleProcsAvailable
 
-static Boolean HostSPBasicSuiteAvailable(SPBasicSuite* proc)
+bool DescriptorSuiteAvaliable(FormatRecordPtr pb)
 {
-    Boolean available = TRUE;
+    bool available = false;
 
-    if (proc == nullptr)
-    {
-        available = FALSE;
-    }
-    else if (proc->AcquireSuite == nullptr ||
-             proc->ReleaseSuite == nullptr ||
-             proc->IsEqual == nullptr ||
-             proc->AllocateBlock == nullptr ||
-             proc->FreeBlock == nullptr ||
-             proc->ReallocateBlock == nullptr ||
-             proc->Undefined == nullptr)
+    if (HostDescriptorAvailable(pb->descriptorParameters, nullptr))
     {
-        available = FALSE;
+        available = true;
     }
 
     return available;
 }
 
-bool ChannelPortsSuiteAvailable(FormatRecordPtr pb)
+bool CheckForRequiredSuites(FormatRecordPtr pb)
 {
     bool available = false;
 
-    if (HostChannelPortAvailable(pb->channelPortProcs, nullptr) && pb->documentInfo != nullptr)
+    if (HostBufferProcsAvailable(pb->bufferProcs, nullptr) && HostHandleProcsAvailable(pb->handleProcs, nullptr))
     {
         available = true;
     }
-    else if (HostSPBasicSuiteAvailable(pb->sSPBasic))
-    {
-        PSChannelPortsSuite1* suite = nullptr;
-        SPErr spErr = pb->sSPBasic->AcquireSuite(kPSChannelPortsSuite,
-                                                 kPSChannelPortsSuiteVersion2,
-                                                 const_cast<const void**>(reinterpret_cast<void**>(&suite)));
-        if (spErr == kSPNoError)
-        {
-            if (suite != nullptr &&
-                suite->New != nullptr &&
-                suite->Dispose != nullptr &&
-                suite->WritePixelsToBaseLevel != nullptr &&
-                suite->ReadScaledPixels != nullptr)
-            {
-                available = true;
-            }
-            pb->sSPBasic->ReleaseSuite(kPSChannelPortsSuite, kPSChannelPortsSuiteVersion2);
-        }
-    }
 
     return available;
 }
 
-bool DescriptorSuiteAvaliable(FormatRecordPtr pb)
+// The BufferID is stored in front of the data so the buffer can be freed from the data pointer,
+// the header size keeps the data 16-byte aligned.
+static const DWORD BufferHeaderSize = 16;
+
+static_assert(sizeof(BufferID) <= BufferHeaderSize, "sizeof(BufferID) > BufferHeaderSize");
+
+BufferSuiteAllocator::BufferSuiteAllocator(FormatRecordPtr pb) : bufferProcs(pb->bufferProcs)
 {
-    bool available = false;
+}
 
-    if (HostDescriptorAvailable(pb->descriptorParameters, nullptr))
+OSErr BufferSuiteAllocator::Allocate(const DWORD size, void** data)
+{
+    *data = nullptr;
+
+    // The Buffer suite uses a signed 32-bit integer for the memory amount.
+    if (size > static_cast<DWORD>(INT_MAX) - BufferHeaderSize)
     {
-        available = true;
+        return memFullErr;
     }
 
-    return available;
+    BufferID id;
+    OSErr e = bufferProcs->allocateProc(static_cast<int32>(size + BufferHeaderSize), &id);
+
+    if (e == noErr)
+    {
+        BYTE* block = reinterpret_cast<BYTE*>(bufferProcs->lockProc(id, FALSE));
+        memcpy(block, &id, sizeof(BufferID));
+
+        *data = block + BufferHeaderSize;
+    }
+
+    return e;
 }
 
-bool CheckForRequiredSuites(FormatRecordPtr pb)
+void BufferSuiteAllocator::Free(void* data)
 {
-    bool available = false;
-
-    if (HostBufferProcsAvailable(pb->bufferProcs, nullptr) && HostHandleProcsAvailable(pb->handleProcs, nullptr))
+    if (data != nullptr)
     {
-        available = true;
-    }
+        BufferID id;
+        memcpy(&id, static_cast<BYTE*>(data) - BufferHeaderSize, sizeof(BufferID));
 
-    return available;
+        bufferProcs->unlockProc(id);
+        bufferProcs->freeProc(id);
+    }
 }
\ No newline at end of file
@@ -23,9 +23,22 @@
 #define UTILITIES_H
 
 #include "Common.h"
+#include "FshAllocator.h"
 
-bool ChannelPortsSuiteAvailable(FormatRecordPtr pb);
 bool DescriptorSuiteAvaliable(FormatRecordPtr pb);
 bool CheckForRequiredSuites(FormatRecordPtr pb);
 
+// Allocates the core library buffers with the Photoshop Buffer suite.
+class BufferSuiteAllocator : public FshAllocator
+{
+public:
+	explicit BufferSuiteAllocator(FormatRecordPtr pb);
+
+	OSErr Allocate(const DWORD size, void** data) override;
+	void Free(void* data) override;
+
+private:
+	BufferProcs* bufferProcs;
+};
+
 #endif // !UTILITIES_H
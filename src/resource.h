@@ -26,6 +26,8 @@
 #define ABOUTCOPYRIGHT                  1018
 #define ABOUTFORMAT                     1019
 #define IDC_ABOUTOK                     1020
+#define QFSCOMPRESSION                  1021
+#define QFSENTRYCOMPRESSION             1022
 #define IMAGECOUNTLABEL                 -1
 
 // Next default values for new objects
@@ -34,7 +36,7 @@
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NEXT_RESOURCE_VALUE        108
 #define _APS_NEXT_COMMAND_VALUE         40001
-#define _APS_NEXT_CONTROL_VALUE         1021
+#define _APS_NEXT_CONTROL_VALUE         1023
 #define _APS_NEXT_SYMED_VALUE           101
 #endif
 #endif
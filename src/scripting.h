@@ -43,6 +43,13 @@
 #define keyFshWriteComp 'fshW'
 #define keyMipCount  'mipC'
 #define keyMipPacked  'mipP'
+#define keyMipFilter  'mipF'
+#define keyQfsCompression 'qfsC'
+#define keyQfsCompressionLevel 'qfsL'
+#define keyQfsEntryCompression 'qfsE'
+#define keyDxtQuality 'dxtQ'
+#define keyDxtPerceptualMetric 'dxtP'
+#define keyDxtTargetError 'dxtE'
 
 #define fshFormatEnum			'bmpT'
 
@@ -32,7 +32,7 @@ struct LoadDialogData
 {
     int selectedIndex;
     int imageCount;
-    HANDLE file;
+    FshArchiveIndex* index;
 };
 
 struct SaveDialogData
@@ -134,8 +134,19 @@ static void InitLoadDlg(HWND dp, const LoadDialogData* dialogData)
 
     for (int i = 0; i < dialogData->imageCount; i++)
     {
+        const FshDirEntry& dir = dialogData->index->GetDirEntry(i);
+
+        if (!IsFshRangeDecompressed(dir.offset + sizeof(FshBmpEntry)))
+        {
+            // Reading the image details of a compressed file would decompress it up to this entry.
+            sprintf_s(s, "#%d %.4s", (i+1), dir.name);
+
+            ComboBox_AddString(menu, s);
+            continue;
+        }
+
         FshBmpEntry entry;
-        if (GetFshBmpInfo(dialogData->file, i, &entry) != noErr)
+        if (dialogData->index->GetBmpEntry(i, &entry) != noErr)
         {
             break;
         }
@@ -230,7 +241,7 @@ static INT_PTR CALLBACK LoadDlgProc(HWND hDlg, UINT wMsg, WPARAM wParam, LPARAM
     return TRUE;
 }
 
-bool LoadFshDlg(FormatRecordPtr pb, const FshHeader& header, int* selectedIndex)
+bool LoadFshDlg(FormatRecordPtr pb, FshArchiveIndex& index, int* selectedIndex)
 {
     *selectedIndex = 0;
 
@@ -238,8 +249,8 @@ bool LoadFshDlg(FormatRecordPtr pb, const FshHeader& header, int* selectedIndex)
     const HWND hWndParent = reinterpret_cast<HWND>(platform->hwnd);
 
     LoadDialogData data;
-    data.file = reinterpret_cast<HANDLE>(pb->dataFork);
-    data.imageCount = header.numBmps;
+    data.imageCount = index.GetEntryCount();
+    data.index = &index;
     data.selectedIndex = 0;
 
     if (DialogBoxParamA(GetModuleInstanceHandle(), MAKEINTRESOURCE(IDD_FSHLOAD), hWndParent, LoadDlgProc, reinterpret_cast<LPARAM>(&data)) == IDOK)
@@ -348,6 +359,9 @@ static void InitSaveDlg(HWND dp, const SaveDialogData* dialogData)
         EnableWindow(GetDlgItem(dp, EMBEDMIPMAPS), FALSE);
     }
 
+    CheckDlgButton(dp, QFSCOMPRESSION, dialogData->options.qfsCompression);
+    CheckDlgButton(dp, QFSENTRYCOMPRESSION, dialogData->options.qfsEntryCompression);
+
     HWND editTxtHwnd = GetDlgItem(dp, ENTRYDIRTXT);
     Edit_LimitText(editTxtHwnd, 4);
 
@@ -409,6 +423,12 @@ static bool SaveFshItem(HWND dp, int item, SaveDialogOptions* outputParams)
     case EMBEDMIPMAPS:
         outputParams->embedMipmaps = (Button_GetCheck(GetDlgItem(dp, EMBEDMIPMAPS)) == BST_CHECKED);
         break;
+    case QFSCOMPRESSION:
+        outputParams->qfsCompression = (Button_GetCheck(GetDlgItem(dp, QFSCOMPRESSION)) == BST_CHECKED);
+        break;
+    case QFSENTRYCOMPRESSION:
+        outputParams->qfsEntryCompression = (Button_GetCheck(GetDlgItem(dp, QFSENTRYCOMPRESSION)) == BST_CHECKED);
+        break;
     }
 
     CheckDlgButton(dp, FSHTYPE_24BIT, (outputParams->fshType == TwentyFourBit));
@@ -463,43 +483,40 @@ static bool EnableMipMapCheckbox(FormatRecordPtr pb, const int mipCount)
 {
     bool enabled = false;
 
-    if (ChannelPortsSuiteAvailable(pb))
+    // Images containing mipmaps must divisible by 2.
+    if ((pb->imageSize.h & 1) == 0 && (pb->imageSize.v & 1) == 0)
     {
-        // Images containing mipmaps must divisible by 2.
-        if ((pb->imageSize.h & 1) == 0 && (pb->imageSize.v & 1) == 0)
+        int numScales = 0;
+
+        if (mipCount > 0)
+        {
+            numScales = mipCount;
+        }
+        else
         {
-            int numScales = 0;
+            int width = pb->imageSize.h;
+            int height = pb->imageSize.v;
 
-            if (mipCount > 0)
+            while (width > 1 && height > 1)
             {
-                numScales = mipCount;
+                numScales++;
+                width >>= 1;
+                height >>= 1;
             }
-            else
+
+            // The FSH format supports a maximum of 15 mipmaps.
+            if (numScales > 15)
             {
-                int width = pb->imageSize.h;
-                int height = pb->imageSize.v;
-
-                while (width > 1 && height > 1)
-                {
-                    numScales++;
-                    width >>= 1;
-                    height >>= 1;
-                }
-
-                // The FSH format supports a maximum of 15 mipmaps.
-                if (numScales > 15)
-                {
-                    numScales = 0;
-                }
+                numScales = 0;
             }
+        }
 
-            if (numScales > 0)
+        if (numScales > 0)
+        {
+            // The image dimensions must be divisible by the total number of mipmaps.
+            if ((pb->imageSize.h % (1 << numScales)) == 0 && (pb->imageSize.v % (1 << numScales)) == 0)
             {
-                // The image dimensions must be divisible by the total number of mipmaps.
-                if ((pb->imageSize.h % (1 << numScales)) == 0 && (pb->imageSize.v % (1 << numScales)) == 0)
-                {
-                    enabled = true;
-                }
+                enabled = true;
             }
         }
     }
@@ -524,6 +541,8 @@ bool SaveFshDlg(FormatRecordPtr pb, const Globals* globals, SaveDialogOptions* o
     memcpy(dialogData.options.entryDirName, globals->entryDir, 4);
     dialogData.options.fshWriteCompression = globals->fshWriteCompression;
     dialogData.options.embedMipmaps = false;
+    dialogData.options.qfsCompression = globals->qfsCompression;
+    dialogData.options.qfsEntryCompression = globals->qfsEntryCompression;
 
     if (DialogBoxParamA(GetModuleInstanceHandle(), MAKEINTRESOURCE(FSHSAVEOPTIONS), hWndParent, SaveDlgProc, reinterpret_cast<LPARAM>(&dialogData)) == IDOK)
     {
@@ -531,6 +550,8 @@ bool SaveFshDlg(FormatRecordPtr pb, const Globals* globals, SaveDialogOptions* o
         memcpy(outputDialogOptions->entryDirName, dialogData.options.entryDirName, 4);
         outputDialogOptions->fshWriteCompression = dialogData.options.fshWriteCompression;
         outputDialogOptions->embedMipmaps = dialogData.options.embedMipmaps;
+        outputDialogOptions->qfsCompression = dialogData.options.qfsCompression;
+        outputDialogOptions->qfsEntryCompression = dialogData.options.qfsEntryCompression;
 
         return true;
     }
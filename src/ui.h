@@ -23,6 +23,7 @@
 #define UI_H
 
 #include "FshFormatPS.h"
+#include "FshArchiveIndex.h"
 
 struct SaveDialogOptions
 {
@@ -30,13 +31,15 @@ struct SaveDialogOptions
 	char entryDirName[4];
 	bool fshWriteCompression;
 	bool embedMipmaps;
+	bool qfsCompression;
+	bool qfsEntryCompression;
 };
 
 // The linker provides this symbol, it represents the module instance handle.
 EXTERN_C IMAGE_DOS_HEADER __ImageBase;
 inline HINSTANCE GetModuleInstanceHandle() { return reinterpret_cast<HINSTANCE>(&__ImageBase); }
 
-bool LoadFshDlg(FormatRecordPtr pb, const FshHeader& header, int* selectedIndex);
+bool LoadFshDlg(FormatRecordPtr pb, FshArchiveIndex& index, int* selectedIndex);
 bool SaveFshDlg(FormatRecordPtr pb, const Globals* globals, SaveDialogOptions* params);
 
 OSErr ShowErrorMessage(FormatRecordPtr pb, const UINT resourceId);
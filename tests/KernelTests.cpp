@@ -0,0 +1,234 @@
+/*
+*  This file is part of FshFormat, a file format plug-in for Adobe Photoshop(R)
+*  that loads and saves FSH images.
+*
+*  Copyright (C) 2011, 2012, 2013, 2014, 2015, 2022, 2023 Nicholas Hayes
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+// Compares the SSE2 pixel and DXT scoring kernels with the scalar code they replace.
+
+#include "DxtScore.h"
+#include "SixteenBitPixels.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+static int failures = 0;
+
+static void Check(const bool condition, const char* message)
+{
+    if (!condition)
+    {
+        fprintf(stderr, "FAILED: %s\n", message);
+        failures++;
+    }
+}
+
+static UINT32 randomSeed = 12345;
+
+static UINT32 NextRandom()
+{
+    randomSeed = (randomSeed * 1103515245U) + 12345U;
+
+    return randomSeed >> 8;
+}
+
+static void FillRandom(std::vector<BYTE>& data)
+{
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = static_cast<BYTE>(NextRandom());
+    }
+
+    // Use the alpha thresholds of the 1555 and 4444 packers often.
+    for (size_t i = 3; i < data.size(); i += 7)
+    {
+        static const BYTE edges[] = { 0, 1, 127, 128, 255 };
+        data[i] = edges[NextRandom() % 5];
+    }
+}
+
+// The widths cover rows shorter than one vector, odd widths and several vectors with a scalar tail.
+static const int MaxWidth = 41;
+
+// The formats with alpha read the fourth byte, so they are only given 4 bytes per pixel.
+template <typename Packer>
+static void TestPackRow(const char* name, const int minColBytes)
+{
+    char message[128];
+
+    for (int colBytes = minColBytes; colBytes <= 4; colBytes++)
+    {
+        for (int width = 1; width <= MaxWidth; width++)
+        {
+            // The source is exactly one row long, so the vector loads must stay inside it.
+            std::vector<BYTE> src(width * colBytes);
+            FillRandom(src);
+
+            std::vector<UINT16> expected(width);
+            for (int x = 0; x < width; x++)
+            {
+                expected[x] = Packer::Pixel(&src[x * colBytes]);
+            }
+
+            std::vector<UINT16> actual(width + 1, 0xBEEF);
+            PackRow<Packer>(src.data(), colBytes, width, actual.data());
+
+            snprintf(message, sizeof(message), "%s packs %d pixels with %d bytes per pixel", name, width, colBytes);
+            Check(memcmp(actual.data(), expected.data(), width * sizeof(UINT16)) == 0, message);
+            Check(actual[width] == 0xBEEF, message);
+        }
+    }
+}
+
+template <typename Unpacker>
+static void TestUnpackPixels(const char* name)
+{
+    char message[128];
+
+    for (int count = 1; count <= MaxWidth; count++)
+    {
+        std::vector<BYTE> srcBytes(count * sizeof(UINT16));
+        FillRandom(srcBytes);
+
+        std::vector<UINT16> src(count);
+        memcpy(src.data(), srcBytes.data(), srcBytes.size());
+
+        std::vector<BYTE> expected(count * Unpacker::Channels);
+        for (int i = 0; i < count; i++)
+        {
+            Unpacker::Pixel(&src[i], &expected[i * Unpacker::Channels]);
+        }
+
+        std::vector<BYTE> actual(expected.size() + 16, 0xA5);
+        UnpackPixels<Unpacker>(src.data(), count, actual.data());
+
+        snprintf(message, sizeof(message), "%s unpacks %d pixels", name, count);
+        Check(memcmp(actual.data(), expected.data(), expected.size()) == 0, message);
+
+        bool untouched = true;
+        for (size_t i = expected.size(); i < actual.size(); i++)
+        {
+            untouched = untouched && actual[i] == 0xA5;
+        }
+        Check(untouched, message);
+    }
+}
+
+#if FSHCODEC_USE_SSE2
+static void TestRemovePaddingByte()
+{
+    for (int i = 0; i < 256; i++)
+    {
+        std::vector<BYTE> src(16);
+        FillRandom(src);
+
+        BYTE expected[12];
+        for (int pixel = 0; pixel < 4; pixel++)
+        {
+            memcpy(expected + (pixel * 3), &src[pixel * 4], 3);
+        }
+
+        BYTE actual[16];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(actual), RemovePaddingByte(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src.data()))));
+
+        Check(memcmp(actual, expected, sizeof(expected)) == 0, "RemovePaddingByte keeps the RGB bytes");
+        Check(actual[12] == 0 && actual[13] == 0 && actual[14] == 0 && actual[15] == 0, "RemovePaddingByte clears the last 4 bytes");
+    }
+}
+#endif // FSHCODEC_USE_SSE2
+
+#if DXTCOMP_USE_SSE2
+static void TestScoreDXTPair()
+{
+    char message[128];
+
+    for (int block = 0; block < 20000; block++)
+    {
+        unsigned int px[16];
+
+        // Mix noise with blocks close to a single colour, where the choices fall near the rounding edges.
+        static const int spreads[] = { 256, 24, 6 };
+        const unsigned int base = NextRandom();
+        const int spread = spreads[block % 3];
+
+        for (int i = 0; i < 16; i++)
+        {
+            const unsigned char* b = reinterpret_cast<const unsigned char*>(&base);
+            unsigned char pixel[4];
+
+            for (int c = 0; c < 3; c++)
+            {
+                const int value = b[c] + static_cast<int>(NextRandom() % spread) - (spread / 2);
+                pixel[c] = static_cast<unsigned char>(value < 0 ? 0 : (value > 255 ? 255 : value));
+            }
+            pixel[3] = static_cast<unsigned char>(NextRandom());
+
+            memcpy(&px[i], pixel, sizeof(unsigned int));
+        }
+
+        // PackDXT only scores pairs of different colours from the block, quantized to 565.
+        const unsigned int col1 = px[NextRandom() % 16] & 0xf8fcf8U;
+        unsigned int col2 = px[NextRandom() % 16] & 0xf8fcf8U;
+
+        if (col1 == col2)
+        {
+            col2 ^= 0x000008U;
+        }
+
+        unsigned int pack;
+        const int expected2 = ScoreDXT(px, 2, col1, col2, &pack);
+        const int expected3 = ScoreDXT(px, 3, col1, col2, &pack);
+
+        int actual2;
+        int actual3;
+        ScoreDXTPair(px, col1, col2, &actual2, &actual3);
+
+        snprintf(message, sizeof(message), "ScoreDXTPair matches ScoreDXT for block %d", block);
+        Check(actual2 == expected2 && actual3 == expected3, message);
+    }
+}
+#endif // DXTCOMP_USE_SSE2
+
+int main()
+{
+    TestPackRow<Pack565>("Pack565", 3);
+    TestPackRow<Pack1555>("Pack1555", 4);
+    TestPackRow<Pack4444>("Pack4444", 4);
+
+    TestUnpackPixels<Unpack565>("Unpack565");
+    TestUnpackPixels<Unpack1555>("Unpack1555");
+    TestUnpackPixels<Unpack4444>("Unpack4444");
+
+#if FSHCODEC_USE_SSE2
+    TestRemovePaddingByte();
+#else
+    puts("SSE2 is not available, only the scalar kernels were run.");
+#endif
+
+#if DXTCOMP_USE_SSE2
+    TestScoreDXTPair();
+#endif
+
+    if (failures == 0)
+    {
+        puts("All kernel tests passed.");
+    }
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
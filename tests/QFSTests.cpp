@@ -0,0 +1,163 @@
+/*
+*  This file is part of FshFormat, a file format plug-in for Adobe Photoshop(R)
+*  that loads and saves FSH images.
+*
+*  Copyright (C) 2011, 2012, 2013, 2014, 2015, 2022, 2023 Nicholas Hayes
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+#include "QFS.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+static int failures = 0;
+
+static void Check(const bool condition, const char* message)
+{
+    if (!condition)
+    {
+        fprintf(stderr, "FAILED: %s\n", message);
+        failures++;
+    }
+}
+
+static std::vector<BYTE> CreateTestData(const DWORD length)
+{
+    std::vector<BYTE> data(length);
+    UINT32 seed = 12345;
+
+    for (DWORD i = 0; i < length; i++)
+    {
+        // Repeat short runs of pseudo-random bytes so the data has both literals and matches.
+        if ((i % 64) < 16 || i < 64)
+        {
+            seed = (seed * 1103515245U) + 12345U;
+            data[i] = static_cast<BYTE>(seed >> 16);
+        }
+        else
+        {
+            data[i] = data[i - 48];
+        }
+    }
+
+    return data;
+}
+
+static void TestRoundTrip(const std::vector<BYTE>& data, const std::vector<BYTE>& compressed)
+{
+    std::vector<BYTE> output(data.size());
+
+    const OSErr e = QFSDecompress(compressed.data(), static_cast<DWORD>(compressed.size()), output.data(), static_cast<DWORD>(output.size()));
+
+    Check(e == noErr, "the complete stream decompresses");
+    Check(output == data, "the complete stream matches the input");
+}
+
+static void TestTruncatedStream(const std::vector<BYTE>& data, const std::vector<BYTE>& compressed)
+{
+    std::vector<BYTE> output(data.size());
+
+    // Cut the stream at a range of lengths, so some of the cuts fall between op codes.
+    const DWORD start = static_cast<DWORD>(compressed.size() / 2);
+
+    for (DWORD truncatedLength = start; truncatedLength < start + 64; truncatedLength++)
+    {
+        QFSDecompressStatus status;
+        const OSErr e = QFSDecompress(compressed.data(), truncatedLength, output.data(), static_cast<DWORD>(output.size()), &status);
+
+        Check(e == formatCannotRead, "a truncated stream is rejected");
+        Check(status.error == formatCannotRead, "the status reports the truncated stream");
+        Check(status.outputOffset < data.size(), "the status reports the partial output length");
+        Check(status.inputOffset <= truncatedLength, "the status input offset is within the input");
+    }
+}
+
+static void TestEarlyEndOfStream()
+{
+    // A header that declares 10 bytes followed by an EOF op code with 3 literal bytes.
+    const BYTE compressed[] = { 0x10, 0xFB, 0x00, 0x00, 0x0A, 0xFF, 'a', 'b', 'c' };
+    BYTE output[10];
+
+    const OSErr e = QFSDecompress(compressed, sizeof(compressed), output, sizeof(output));
+
+    Check(e == formatCannotRead, "an early EOF op code is rejected");
+}
+
+static void TestInvalidHeader()
+{
+    const BYTE badSignature[] = { 0x10, 0xFA, 0x00, 0x00, 0x03, 0xFC };
+    const BYTE truncatedHeader[] = { 0x10, 0xFB, 0x00, 0x00, 0x03 };
+    // Too short for the signature that follows a 4 byte length prefix.
+    const BYTE truncatedPrefix[] = { 0x00, 0x00, 0x00, 0x06, 0x10 };
+    BYTE output[16];
+    QFSDecompressStatus status;
+
+    OSErr e = QFSDecompress(badSignature, sizeof(badSignature), output, sizeof(output), &status);
+
+    Check(e == formatCannotRead, "an unknown signature is rejected");
+    Check(status.error == formatCannotRead && status.outputOffset == 0, "the status reports the unknown signature");
+
+    e = QFSDecompress(truncatedHeader, sizeof(truncatedHeader), output, sizeof(output), &status);
+
+    Check(e == formatCannotRead, "a truncated header is rejected");
+    Check(status.error == formatCannotRead && status.outputOffset == 0, "the status reports the truncated header");
+
+    e = QFSDecompress(truncatedPrefix, sizeof(truncatedPrefix), output, sizeof(output), &status);
+
+    Check(e == formatCannotRead, "a truncated length prefixed header is rejected");
+
+    int uncompressedSize = -1;
+    e = GetUncompressedSize(badSignature, sizeof(badSignature), &uncompressedSize);
+
+    Check(e == formatCannotRead && uncompressedSize == 0, "GetUncompressedSize rejects an unknown signature");
+}
+
+int main()
+{
+    const std::vector<BYTE> data = CreateTestData(200000);
+    std::vector<BYTE> compressed(data.size() + 1024);
+    DWORD compressedLength = 0;
+
+    const OSErr e = QFSCompress(data.data(),
+                                static_cast<DWORD>(data.size()),
+                                compressed.data(),
+                                static_cast<DWORD>(compressed.size()),
+                                QFSCompressionNormal,
+                                false,
+                                &compressedLength);
+
+    Check(e == noErr && compressedLength > 0, "the test data compresses");
+
+    if (e == noErr && compressedLength > 0)
+    {
+        compressed.resize(compressedLength);
+
+        TestRoundTrip(data, compressed);
+        TestTruncatedStream(data, compressed);
+    }
+
+    TestEarlyEndOfStream();
+    TestInvalidHeader();
+
+    if (failures == 0)
+    {
+        puts("All QFS tests passed.");
+    }
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
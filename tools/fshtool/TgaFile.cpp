@@ -0,0 +1,256 @@
+/*
+*  This file is part of FshFormat, a file format plug-in for Adobe Photoshop(R)
+*  that loads and saves FSH images.
+*
+*  Copyright (C) 2011, 2012, 2013, 2014, 2015, 2022, 2023 Nicholas Hayes
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+
+#include "TgaFile.h"
+#include "FileIo.h"
+#include <limits.h>
+#include <new>
+#include <string.h>
+
+static const int TgaHeaderSize = 18;
+
+enum TgaImageType
+{
+    TgaTrueColor = 2,
+    TgaTrueColorRle = 10
+};
+
+// Copies a BGR(A) pixel to the RGBA output.
+static void CopyTgaPixel(const BYTE* src, const int bytesPerPixel, BYTE* dst)
+{
+    dst[0] = src[2];
+    dst[1] = src[1];
+    dst[2] = src[0];
+    dst[3] = bytesPerPixel == 4 ? src[3] : 255;
+}
+
+static OSErr DecodeTgaImage(const BYTE* data, const DWORD length, std::unique_ptr<BYTE[]>* pixels, int* width, int* height, bool* hasAlpha)
+{
+    if (length < static_cast<DWORD>(TgaHeaderSize))
+    {
+        return formatCannotRead;
+    }
+
+    const int idLength = data[0];
+    const int colorMapType = data[1];
+    const int imageType = data[2];
+    const int colorMapLength = data[5] | (data[6] << 8);
+    const int colorMapEntryBits = data[7];
+    const int imageWidth = data[12] | (data[13] << 8);
+    const int imageHeight = data[14] | (data[15] << 8);
+    const int bitsPerPixel = data[16];
+    const int descriptor = data[17];
+
+    if ((imageType != TgaTrueColor && imageType != TgaTrueColorRle) ||
+        (bitsPerPixel != 24 && bitsPerPixel != 32) ||
+        imageWidth == 0 || imageHeight == 0 ||
+        (descriptor & 0x10) != 0) // right-to-left images are not supported
+    {
+        return formatCannotRead;
+    }
+
+    const int bytesPerPixel = bitsPerPixel / 8;
+    const bool topDown = (descriptor & 0x20) != 0;
+
+    DWORD offset = TgaHeaderSize + idLength;
+
+    if (colorMapType == 1)
+    {
+        offset += colorMapLength * ((colorMapEntryBits + 7) / 8);
+    }
+
+    const DWORD pixelCount = static_cast<DWORD>(imageWidth) * static_cast<DWORD>(imageHeight);
+
+    if (pixelCount > (MAXDWORD / 4))
+    {
+        return memFullErr; // The 32-bit image would not fit in a DWORD.
+    }
+
+    BYTE* out = new (std::nothrow) BYTE[pixelCount * 4];
+
+    if (out == nullptr)
+    {
+        return memFullErr;
+    }
+
+    pixels->reset(out);
+
+    DWORD index = 0;
+
+    while (index < pixelCount)
+    {
+        DWORD runLength = 1;
+        bool repeat = false;
+
+        if (imageType == TgaTrueColorRle)
+        {
+            if (offset >= length)
+            {
+                return formatCannotRead;
+            }
+
+            const BYTE packet = data[offset++];
+            runLength = (packet & 0x7f) + 1;
+            repeat = (packet & 0x80) != 0;
+        }
+        else
+        {
+            runLength = pixelCount;
+        }
+
+        if (runLength > pixelCount - index)
+        {
+            return formatCannotRead;
+        }
+
+        const DWORD dataLength = repeat ? bytesPerPixel : runLength * bytesPerPixel;
+
+        if (offset > length || dataLength > length - offset)
+        {
+            return formatCannotRead;
+        }
+
+        for (DWORD i = 0; i < runLength; i++)
+        {
+            const DWORD pixel = index + i;
+            const DWORD x = pixel % imageWidth;
+            const DWORD y = topDown ? pixel / imageWidth : (imageHeight - 1) - (pixel / imageWidth);
+
+            CopyTgaPixel(data + offset + (repeat ? 0 : i * bytesPerPixel), bytesPerPixel, out + ((y * imageWidth + x) * 4));
+        }
+
+        offset += dataLength;
+        index += runLength;
+    }
+
+    *width = imageWidth;
+    *height = imageHeight;
+    *hasAlpha = bytesPerPixel == 4;
+
+    return noErr;
+}
+
+OSErr ReadTgaImage(const char* path, std::unique_ptr<BYTE[]>* pixels, int* width, int* height, bool* hasAlpha)
+{
+    HANDLE file;
+    OSErr e = OpenFile(path, false, &file);
+
+    if (e == noErr)
+    {
+        INT64 size;
+        e = GetFileSize(file, &size);
+
+        if (e == noErr && (size <= 0 || size > INT_MAX))
+        {
+            e = formatCannotRead;
+        }
+
+        if (e == noErr)
+        {
+            std::unique_ptr<BYTE[]> data(new (std::nothrow) BYTE[static_cast<size_t>(size)]);
+
+            if (data == nullptr)
+            {
+                e = memFullErr;
+            }
+            else
+            {
+                e = ReadBytes(file, data.get(), static_cast<DWORD>(size));
+
+                if (e == noErr)
+                {
+                    e = DecodeTgaImage(data.get(), static_cast<DWORD>(size), pixels, width, height, hasAlpha);
+                }
+            }
+        }
+
+        CloseFile(file);
+    }
+
+    return e;
+}
+
+OSErr WriteTgaImage(const char* path, const BYTE* pixels, const int width, const int height, const int channels)
+{
+    const DWORD rowLength = static_cast<DWORD>(width * channels);
+    std::unique_ptr<BYTE[]> row(new (std::nothrow) BYTE[rowLength]);
+
+    if (row == nullptr)
+    {
+        return memFullErr;
+    }
+
+    BYTE header[TgaHeaderSize];
+    memset(header, 0, sizeof(header));
+    header[2] = TgaTrueColor;
+    header[12] = static_cast<BYTE>(width);
+    header[13] = static_cast<BYTE>(width >> 8);
+    header[14] = static_cast<BYTE>(height);
+    header[15] = static_cast<BYTE>(height >> 8);
+    header[16] = static_cast<BYTE>(channels * 8);
+    // Top-down with 8 alpha bits for 32-bit images.
+    header[17] = static_cast<BYTE>(0x20 | (channels == 4 ? 8 : 0));
+
+    HANDLE file;
+    OSErr e = OpenFile(path, true, &file);
+
+    if (e == noErr)
+    {
+        {
+            BufferedFileWriter writer(file);
+
+            e = writer.WriteBytes(header, sizeof(header));
+
+            for (int y = 0; y < height && e == noErr; y++)
+            {
+                const BYTE* src = pixels + (y * rowLength);
+                BYTE* dst = row.get();
+
+                for (int x = 0; x < width; x++)
+                {
+                    dst[0] = src[2];
+                    dst[1] = src[1];
+                    dst[2] = src[0];
+
+                    if (channels == 4)
+                    {
+                        dst[3] = src[3];
+                    }
+
+                    src += channels;
+                    dst += channels;
+                }
+
+                e = writer.WriteBytes(row.get(), rowLength);
+            }
+
+            if (e == noErr)
+            {
+                e = writer.Flush();
+            }
+        }
+
+        CloseFile(file);
+    }
+
+    return e;
+}
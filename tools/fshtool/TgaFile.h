@@ -0,0 +1,35 @@
+/*
+*  This file is part of FshFormat, a file format plug-in for Adobe Photoshop(R)
+*  that loads and saves FSH images.
+*
+*  Copyright (C) 2011, 2012, 2013, 2014, 2015, 2022, 2023 Nicholas Hayes
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+
+#ifndef TGAFILE_H
+#define TGAFILE_H
+
+#include "Common.h"
+#include <memory>
+
+// Reads an uncompressed or RLE compressed 24-bit or 32-bit TGA image as top-down RGBA pixels,
+// 24-bit images are given an opaque alpha channel.
+OSErr ReadTgaImage(const char* path, std::unique_ptr<BYTE[]>* pixels, int* width, int* height, bool* hasAlpha);
+// Writes top-down RGB or RGBA pixels as an uncompressed TGA image.
+OSErr WriteTgaImage(const char* path, const BYTE* pixels, const int width, const int height, const int channels);
+
+#endif // !TGAFILE_H
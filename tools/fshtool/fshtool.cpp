@@ -0,0 +1,972 @@
+/*
+*  This file is part of FshFormat, a file format plug-in for Adobe Photoshop(R)
+*  that loads and saves FSH images.
+*
+*  Copyright (C) 2011, 2012, 2013, 2014, 2015, 2022, 2023 Nicholas Hayes
+*
+*  This program is free software: you can redistribute it and/or modify
+*  it under the terms of the GNU General Public License as published by
+*  the Free Software Foundation, either version 3 of the License, or
+*  (at your option) any later version.
+*
+*  This program is distributed in the hope that it will be useful,
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*  GNU General Public License for more details.
+*
+*  You should have received a copy of the GNU General Public License
+*  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*
+*/
+
+
+// A command line tool that reads and writes FSH files with the same code as the plug-in.
+
+#include "Common.h"
+#include "FileIo.h"
+#include "FshArchiveIndex.h"
+#include "FshCodec.h"
+#include "FshIo.h"
+#include "QFS.h"
+#include "TgaFile.h"
+#include <limits.h>
+#include <memory>
+#include <new>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct FormatName
+{
+    const char* name;
+    FshBmpType code;
+};
+
+static const FormatName formatNames[] =
+{
+    { "dxt1", DXT1 },
+    { "dxt3", DXT3 },
+    { "32", ThirtyTwoBit },
+    { "24", TwentyFourBit },
+    { "565", SixteenBit },
+    { "1555", SixteenBitAlpha },
+    { "4444", SixteenBit4x4 }
+};
+
+static const int formatNameCount = sizeof(formatNames) / sizeof(formatNames[0]);
+
+static void PrintUsage()
+{
+    fputs("Usage: fshtool <command> [options]\n"
+          "\n"
+          "  info <file.fsh>\n"
+          "      Lists the images in the file.\n"
+          "\n"
+          "  decode [-i index] <file.fsh> <image.tga>\n"
+          "      Saves the image at the specified index as a TGA image, the default is 0.\n"
+          "\n"
+          "  encode [options] <image.tga> <file.fsh>\n"
+          "      -f format  dxt1, dxt3, 32, 24, 565, 1555 or 4444, the default is dxt1.\n"
+          "      -m count   The number of mipmaps to generate.\n"
+          "      -p         Pack the mipmaps without padding.\n"
+          "      -g         Filter the mipmaps in linear light, treating the colours as sRGB.\n"
+          "      -s         Use libsquish for DXT compression.\n"
+          "      -t quality fastest, normal or best libsquish fit, the default is best.\n"
+          "      -w         Use the perceptual colour metric for libsquish.\n"
+          "      -x error   Stop the libsquish fit once the mean squared error per pixel is below this.\n"
+          "      -c         QFS compress the file.\n"
+          "      -e         QFS compress the image entry.\n"
+          "      -q level   fast, normal or max, the default is normal.\n"
+          "      -d id      The 4 character directory id, the default is G264.\n"
+          "      -n name    The 4 character entry name, the default is FiSH.\n"
+          "      -v         Print the mipmap encoder stage times, the reused DXT blocks and the QFS speed.\n"
+          "\n"
+          "  recompress [-q level] [-u] [-v] <in.fsh> <out.fsh>\n"
+          "      QFS compresses the file, or decompresses it with -u.\n"
+          "      -v prints the compressed size and the QFS speed.\n",
+          stderr);
+}
+
+static const char* GetErrorMessage(const OSErr e)
+{
+    switch (e)
+    {
+    case ioErr:
+        return "I/O error";
+    case eofErr:
+        return "unexpected end of file";
+    case writErr:
+        return "write error";
+    case memFullErr:
+        return "out of memory";
+    case paramErr:
+        return "invalid parameter";
+    case formatCannotRead:
+        return "unsupported or invalid file";
+    case formatBadParameters:
+        return "the image cannot be saved in the selected format";
+    default:
+        return "unknown error";
+    }
+}
+
+static int ReportError(const char* path, const OSErr e)
+{
+    fprintf(stderr, "fshtool: %s: %s (%d).\n", path, GetErrorMessage(e), e);
+
+    return EXIT_FAILURE;
+}
+
+static const char* GetFormatName(const FshBmpType code)
+{
+    for (int i = 0; i < formatNameCount; i++)
+    {
+        if (formatNames[i].code == code)
+        {
+            return formatNames[i].name;
+        }
+    }
+
+    return "unsupported";
+}
+
+static bool ParseFormat(const char* name, FshBmpType* code)
+{
+    for (int i = 0; i < formatNameCount; i++)
+    {
+        if (strcmp(formatNames[i].name, name) == 0)
+        {
+            *code = formatNames[i].code;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool ParseCompressionLevel(const char* name, QFSCompressionLevel* level)
+{
+    if (strcmp(name, "fast") == 0)
+    {
+        *level = QFSCompressionFast;
+    }
+    else if (strcmp(name, "normal") == 0)
+    {
+        *level = QFSCompressionNormal;
+    }
+    else if (strcmp(name, "max") == 0)
+    {
+        *level = QFSCompressionMax;
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+static bool ParseDxtQuality(const char* name, DxtCompressionQuality* quality)
+{
+    if (strcmp(name, "fastest") == 0)
+    {
+        *quality = DxtQualityFastest;
+    }
+    else if (strcmp(name, "normal") == 0)
+    {
+        *quality = DxtQualityNormal;
+    }
+    else if (strcmp(name, "best") == 0)
+    {
+        *quality = DxtQualityBest;
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+static bool ParseIdentifier(const char* text, char (&identifier)[4])
+{
+    if (strlen(text) != 4)
+    {
+        return false;
+    }
+
+    memcpy(identifier, text, 4);
+
+    return true;
+}
+
+// Opens a FSH file with the same on demand decompression and memory mapping as the plug-in,
+// only one file can be open at a time because that state is global.
+class FshInputFile
+{
+public:
+    FshInputFile() : file(nullptr)
+    {
+    }
+
+    ~FshInputFile()
+    {
+        Close();
+    }
+
+    OSErr Open(const char* path)
+    {
+        OSErr e = OpenFile(path, false, &file);
+
+        if (e == noErr)
+        {
+            e = DecompressFsh(allocator, file);
+
+            if (e == noErr)
+            {
+                if (qfsBuffer == nullptr)
+                {
+                    // The mapping is optional, the readers fall back to the file if it fails.
+                    MapFsh(file);
+                }
+
+                e = index.Load(file);
+            }
+        }
+
+        return e;
+    }
+
+    void Close()
+    {
+        if (file != nullptr)
+        {
+            FreeDecompressedFsh(allocator);
+            UnmapFsh();
+            CloseFile(file);
+            file = nullptr;
+        }
+    }
+
+    FshAllocator& GetAllocator()
+    {
+        return allocator;
+    }
+
+    FshArchiveIndex& GetIndex()
+    {
+        return index;
+    }
+
+private:
+    FshInputFile(const FshInputFile& copyMe);
+
+    HeapAllocator allocator;
+    HANDLE file;
+    FshArchiveIndex index;
+};
+
+static int RunInfo(int argc, char** argv)
+{
+    if (argc != 1)
+    {
+        PrintUsage();
+        return EXIT_FAILURE;
+    }
+
+    const char* path = argv[0];
+
+    FshInputFile input;
+    OSErr e = input.Open(path);
+
+    if (e != noErr)
+    {
+        return ReportError(path, e);
+    }
+
+    FshArchiveIndex& index = input.GetIndex();
+    const FshHeader& header = index.GetHeader();
+
+    printf("%s: %d image(s), directory id '%.4s', %s.\n",
+           path,
+           index.GetEntryCount(),
+           header.dirID,
+           qfsBuffer != nullptr ? "QFS compressed" : "not compressed");
+
+    for (int i = 0; i < index.GetEntryCount(); i++)
+    {
+        const FshDirEntry& dir = index.GetDirEntry(i);
+
+        FshBmpEntry entry;
+        e = index.GetBmpEntry(i, &entry);
+
+        if (e != noErr)
+        {
+            return ReportError(path, e);
+        }
+
+        const FshBmpType code = static_cast<FshBmpType>(entry.code & 0x7f);
+
+        printf("  %d: '%.4s' at offset %d, %s (0x%02X), %dx%d",
+               i,
+               dir.name,
+               dir.offset,
+               GetFormatName(code),
+               code,
+               entry.width,
+               entry.height);
+
+        if (IsSupportedFshBmpType(code))
+        {
+            int mipCount;
+            bool mipPacked;
+
+            e = index.GetMipCount(i, &mipCount, &mipPacked);
+
+            if (e != noErr)
+            {
+                return ReportError(path, e);
+            }
+
+            if (mipCount > 0)
+            {
+                printf(", %d %s mipmap(s)", mipCount, mipPacked ? "packed" : "padded");
+            }
+        }
+
+        if ((entry.code & 0x80) != 0)
+        {
+            printf(", QFS compressed");
+        }
+
+        printf("\n");
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static int RunDecode(int argc, char** argv)
+{
+    int entryIndex = 0;
+    int arg = 0;
+
+    if (argc >= 2 && strcmp(argv[0], "-i") == 0)
+    {
+        entryIndex = atoi(argv[1]);
+        arg = 2;
+    }
+
+    if (argc - arg != 2)
+    {
+        PrintUsage();
+        return EXIT_FAILURE;
+    }
+
+    const char* inputPath = argv[arg];
+    const char* outputPath = argv[arg + 1];
+
+    FshInputFile input;
+    OSErr e = input.Open(inputPath);
+
+    if (e != noErr)
+    {
+        return ReportError(inputPath, e);
+    }
+
+    FshArchiveIndex& index = input.GetIndex();
+
+    if (entryIndex < 0 || entryIndex >= index.GetEntryCount())
+    {
+        fprintf(stderr, "fshtool: %s: the image index must be between 0 and %d.\n", inputPath, index.GetEntryCount() - 1);
+        return EXIT_FAILURE;
+    }
+
+    FshBmpEntry entry;
+    e = index.GetBmpEntry(entryIndex, &entry);
+
+    if (e != noErr)
+    {
+        return ReportError(inputPath, e);
+    }
+
+    const FshBmpType code = static_cast<FshBmpType>(entry.code & 0x7f);
+
+    if (!IsSupportedFshBmpType(code))
+    {
+        e = formatCannotRead;
+    }
+
+    int dataSize = 0;
+
+    if (e == noErr)
+    {
+        e = GetFshImageDataSize(index, entryIndex, entry, &dataSize);
+
+        if (e == noErr && dataSize < GetImageDataSize(entry.width, entry.height, code))
+        {
+            e = formatCannotRead; // The entry is too small for its dimensions.
+        }
+    }
+
+    const void* imageData = nullptr;
+    std::unique_ptr<BYTE[]> readBuffer;
+
+    if (e == noErr)
+    {
+        e = GetFshImageDataView(index, entryIndex, entry, dataSize, &imageData);
+
+        if (e == noErr && imageData == nullptr)
+        {
+            readBuffer.reset(new (std::nothrow) BYTE[dataSize]);
+
+            if (readBuffer == nullptr)
+            {
+                e = memFullErr;
+            }
+            else
+            {
+                e = ReadFshImageData(input.GetAllocator(), index, entryIndex, entry, readBuffer.get(), dataSize);
+                imageData = readBuffer.get();
+            }
+        }
+    }
+
+    if (e != noErr)
+    {
+        return ReportError(inputPath, e);
+    }
+
+    const int channels = GetFshBmpChannelCount(code);
+    const size_t pixelCount = static_cast<size_t>(entry.width) * static_cast<size_t>(entry.height);
+
+    if (pixelCount > (SIZE_MAX / static_cast<size_t>(channels)))
+    {
+        return ReportError(inputPath, memFullErr);
+    }
+
+    std::unique_ptr<BYTE[]> pixels(new (std::nothrow) BYTE[pixelCount * static_cast<size_t>(channels)]);
+
+    if (pixels == nullptr)
+    {
+        return ReportError(inputPath, memFullErr);
+    }
+
+    DecodeFshImage(code, entry.width, entry.height, imageData, pixels.get());
+
+    e = WriteTgaImage(outputPath, pixels.get(), entry.width, entry.height, channels);
+
+    if (e != noErr)
+    {
+        return ReportError(outputPath, e);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static void PrintQFSCompressionStats(const char* name, const QFSCompressionStats& stats)
+{
+    const double seconds = stats.compressTime / 1000.0;
+
+    printf("%s: %lu bytes to %lu bytes in %.2f ms",
+           name,
+           static_cast<unsigned long>(stats.rawLength),
+           static_cast<unsigned long>(stats.compressedLength),
+           stats.compressTime);
+
+    if (seconds > 0.0)
+    {
+        printf(", %.2f MB/s raw, %.2f MB/s compressed",
+               (static_cast<double>(stats.rawLength) / seconds) / 1048576.0,
+               (static_cast<double>(stats.compressedLength) / seconds) / 1048576.0);
+    }
+
+    if (stats.compressedLength == 0)
+    {
+        fputs(", left uncompressed", stdout);
+    }
+
+    putchar('\n');
+}
+
+// Writes a FSH file containing a single image, in the same way as the plug-in.
+static OSErr WriteFshImageFile(HANDLE file,
+                               FshAllocator& allocator,
+                               const FshEncodeOptions& options,
+                               const char (&headerDir)[4],
+                               const char (&entryName)[4],
+                               const bool qfsCompression,
+                               const bool qfsEntryCompression,
+                               const QFSCompressionLevel level,
+                               const BYTE* pixels,
+                               const int width,
+                               const int height,
+                               const int planes,
+                               const bool printTimings)
+{
+    FshHeader head;
+    ZeroMemory(&head, sizeof(FshHeader));
+    memcpy(head.SHPI, "SHPI", 4);
+    head.size = 0; // Placeholder for the real length which will be written after the image data.
+    head.numBmps = 1;
+    memcpy(head.dirID, headerDir, 4);
+
+    FshDirEntry dir;
+    ZeroMemory(&dir, sizeof(FshDirEntry));
+    memcpy(dir.name, entryName, 4);
+    dir.offset = sizeof(FshHeader) + sizeof(FshDirEntry);
+
+    FshBmpEntry entry;
+    ZeroMemory(&entry, sizeof(FshBmpEntry));
+    entry.code = options.code;
+    entry.width = static_cast<UINT16>(width);
+    entry.height = static_cast<UINT16>(height);
+
+    OSErr e = noErr;
+
+    {
+        BufferedFileWriter writer(file);
+
+        e = WriteFshHeader(writer, head);
+
+        if (e == noErr)
+        {
+            e = WriteFshDir(writer, dir);
+        }
+
+        if (e == noErr)
+        {
+            e = WriteFshEntryDir(writer, dir, entry);
+        }
+
+        if (e == noErr)
+        {
+            e = writer.Flush();
+        }
+    }
+
+    if (e == noErr)
+    {
+        e = SetFilePosition(file, FILE_BEGIN, dir.offset + sizeof(FshBmpEntry));
+    }
+
+    FshDxtBlockCounts blockCounts;
+    blockCounts.total = 0;
+    blockCounts.unique = 0;
+
+    if (e == noErr)
+    {
+        e = EncodeFshImage(allocator, file, options, pixels, width, height, width * 4, 4, planes, &blockCounts);
+    }
+
+    if (e == noErr && options.mipCount > 0)
+    {
+        FshMipChainTimings timings;
+        e = EncodeFshMipChain(allocator, file, options, pixels, width, height, width * 4, 4, planes, &timings, &blockCounts);
+
+        if (e == noErr && printTimings)
+        {
+            printf("mipmaps: downsample %.2f ms, encode %.2f ms, write %.2f ms, total %.2f ms\n",
+                   timings.downsample,
+                   timings.encode,
+                   timings.write,
+                   timings.total);
+        }
+
+        if (e == noErr)
+        {
+            e = UpdateFshEntryHeader(file, dir, entry, options.mipCount);
+        }
+    }
+
+    if (e == noErr && printTimings && blockCounts.total > 0)
+    {
+        printf("dxt blocks: %d unique of %d, %.1f%% reused\n",
+               blockCounts.unique,
+               blockCounts.total,
+               (static_cast<double>(blockCounts.total - blockCounts.unique) * 100.0) / static_cast<double>(blockCounts.total));
+    }
+
+    if (e == noErr && qfsEntryCompression)
+    {
+        FshBmpEntry compressedEntry = entry;
+        compressedEntry.misc[3] = static_cast<UINT16>(options.mipCount << 12);
+
+        QFSCompressionStats stats;
+        stats.rawLength = 0;
+
+        e = QFSCompressFshEntry(allocator, file, dir, compressedEntry, level, &stats);
+
+        if (e == noErr && printTimings && stats.rawLength > 0)
+        {
+            PrintQFSCompressionStats("qfs entry", stats);
+        }
+    }
+
+    if (e == noErr)
+    {
+        e = WriteFshFileLength(file);
+    }
+
+    if (e == noErr && qfsCompression)
+    {
+        QFSCompressionStats stats;
+        stats.rawLength = 0;
+
+        e = QFSCompressFsh(allocator, file, level, &stats);
+
+        if (e == noErr && printTimings && stats.rawLength > 0)
+        {
+            PrintQFSCompressionStats("qfs file", stats);
+        }
+    }
+
+    return e;
+}
+
+static int RunEncode(int argc, char** argv)
+{
+    FshEncodeOptions options;
+    options.code = DXT1;
+    options.squishDxt = false;
+    options.dxtQuality = DxtQualityBest;
+    options.dxtPerceptualMetric = false;
+    options.dxtTargetError = 0.0f;
+    options.mipCount = 0;
+    options.mipPacked = false;
+    options.mipFilter = MipFilterBox;
+
+    bool qfsCompression = false;
+    bool qfsEntryCompression = false;
+    QFSCompressionLevel level = QFSCompressionNormal;
+    char headerDir[4] = { 'G', '2', '6', '4' };
+    char entryName[4] = { 'F', 'i', 'S', 'H' };
+    bool printTimings = false;
+
+    int arg = 0;
+
+    for (; arg < argc && argv[arg][0] == '-'; arg++)
+    {
+        const char* option = argv[arg];
+        const char* value = (arg + 1) < argc ? argv[arg + 1] : nullptr;
+        bool valid = true;
+
+        if (strcmp(option, "-p") == 0)
+        {
+            options.mipPacked = true;
+        }
+        else if (strcmp(option, "-g") == 0)
+        {
+            options.mipFilter = MipFilterGammaCorrect;
+        }
+        else if (strcmp(option, "-s") == 0)
+        {
+            options.squishDxt = true;
+        }
+        else if (strcmp(option, "-w") == 0)
+        {
+            options.dxtPerceptualMetric = true;
+        }
+        else if (strcmp(option, "-c") == 0)
+        {
+            qfsCompression = true;
+        }
+        else if (strcmp(option, "-e") == 0)
+        {
+            qfsEntryCompression = true;
+        }
+        else if (strcmp(option, "-v") == 0)
+        {
+            printTimings = true;
+        }
+        else if (value == nullptr)
+        {
+            valid = false;
+        }
+        else
+        {
+            if (strcmp(option, "-f") == 0)
+            {
+                valid = ParseFormat(value, &options.code);
+            }
+            else if (strcmp(option, "-m") == 0)
+            {
+                options.mipCount = atoi(value);
+                valid = options.mipCount >= 0 && options.mipCount <= 15;
+            }
+            else if (strcmp(option, "-q") == 0)
+            {
+                valid = ParseCompressionLevel(value, &level);
+            }
+            else if (strcmp(option, "-t") == 0)
+            {
+                valid = ParseDxtQuality(value, &options.dxtQuality);
+            }
+            else if (strcmp(option, "-x") == 0)
+            {
+                options.dxtTargetError = static_cast<float>(atof(value));
+                valid = options.dxtTargetError >= 0.0f;
+            }
+            else if (strcmp(option, "-d") == 0)
+            {
+                valid = ParseIdentifier(value, headerDir);
+            }
+            else if (strcmp(option, "-n") == 0)
+            {
+                valid = ParseIdentifier(value, entryName);
+            }
+            else
+            {
+                valid = false;
+            }
+
+            arg++;
+        }
+
+        if (!valid)
+        {
+            fprintf(stderr, "fshtool: invalid option '%s'.\n", option);
+            PrintUsage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (argc - arg != 2)
+    {
+        PrintUsage();
+        return EXIT_FAILURE;
+    }
+
+    const char* inputPath = argv[arg];
+    const char* outputPath = argv[arg + 1];
+
+    std::unique_ptr<BYTE[]> pixels;
+    int width;
+    int height;
+    bool hasAlpha;
+
+    OSErr e = ReadTgaImage(inputPath, &pixels, &width, &height, &hasAlpha);
+
+    if (e != noErr)
+    {
+        return ReportError(inputPath, e);
+    }
+
+    if ((options.code == DXT1 || options.code == DXT3) && ((width & 3) != 0 || (height & 3) != 0))
+    {
+        fprintf(stderr, "fshtool: %s: DXT compressed images must be a multiple of 4 pixels.\n", inputPath);
+        return EXIT_FAILURE;
+    }
+
+    if ((width % (1 << options.mipCount)) != 0 || (height % (1 << options.mipCount)) != 0)
+    {
+        fprintf(stderr, "fshtool: %s: the image size must be divisible by %d for %d mipmaps.\n", inputPath, 1 << options.mipCount, options.mipCount);
+        return EXIT_FAILURE;
+    }
+
+    int planes = GetFshBmpChannelCount(options.code);
+
+    if (options.code == DXT1 && !hasAlpha)
+    {
+        planes = 3;
+    }
+
+    HANDLE file;
+    e = OpenFile(outputPath, true, &file);
+
+    if (e == noErr)
+    {
+        HeapAllocator allocator;
+
+        e = WriteFshImageFile(file,
+                              allocator,
+                              options,
+                              headerDir,
+                              entryName,
+                              qfsCompression,
+                              qfsEntryCompression,
+                              level,
+                              pixels.get(),
+                              width,
+                              height,
+                              planes,
+                              printTimings);
+
+        CloseFile(file);
+    }
+
+    if (e != noErr)
+    {
+        return ReportError(outputPath, e);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static int RunRecompress(int argc, char** argv)
+{
+    QFSCompressionLevel level = QFSCompressionNormal;
+    bool decompress = false;
+    bool printStats = false;
+    int arg = 0;
+
+    for (; arg < argc && argv[arg][0] == '-'; arg++)
+    {
+        if (strcmp(argv[arg], "-u") == 0)
+        {
+            decompress = true;
+        }
+        else if (strcmp(argv[arg], "-v") == 0)
+        {
+            printStats = true;
+        }
+        else if (strcmp(argv[arg], "-q") == 0 && (arg + 1) < argc && ParseCompressionLevel(argv[arg + 1], &level))
+        {
+            arg++;
+        }
+        else
+        {
+            fprintf(stderr, "fshtool: invalid option '%s'.\n", argv[arg]);
+            PrintUsage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (argc - arg != 2)
+    {
+        PrintUsage();
+        return EXIT_FAILURE;
+    }
+
+    const char* inputPath = argv[arg];
+    const char* outputPath = argv[arg + 1];
+
+    if (strcmp(inputPath, outputPath) == 0)
+    {
+        fputs("fshtool: the input and output must be different files.\n", stderr);
+        return EXIT_FAILURE;
+    }
+
+    FshInputFile input;
+    OSErr e = input.Open(inputPath);
+
+    if (e != noErr)
+    {
+        return ReportError(inputPath, e);
+    }
+
+    HANDLE inputFile = input.GetIndex().GetFile();
+    DWORD size = 0;
+
+    if (qfsBuffer != nullptr)
+    {
+        int uncompressedSize;
+        e = GetUncompressedSize(inputFile, 0, &uncompressedSize);
+        size = static_cast<DWORD>(uncompressedSize);
+    }
+    else
+    {
+        INT64 fileSize;
+        e = GetFileSize(inputFile, &fileSize);
+
+        if (e == noErr && fileSize > INT_MAX)
+        {
+            e = memFullErr;
+        }
+
+        size = static_cast<DWORD>(fileSize);
+    }
+
+    const BYTE* data = nullptr;
+
+    if (e == noErr)
+    {
+        e = GetInMemoryFshData(0, size, &data);
+    }
+
+    std::unique_ptr<BYTE[]> readBuffer;
+
+    if (e == noErr && data == nullptr)
+    {
+        readBuffer.reset(new (std::nothrow) BYTE[size]);
+
+        if (readBuffer == nullptr)
+        {
+            e = memFullErr;
+        }
+        else
+        {
+            BufferedFileReader reader(inputFile);
+
+            e = reader.ReadBytes(readBuffer.get(), size);
+            data = readBuffer.get();
+        }
+    }
+
+    if (e != noErr)
+    {
+        return ReportError(inputPath, e);
+    }
+
+    HANDLE file;
+    e = OpenFile(outputPath, true, &file);
+
+    if (e == noErr)
+    {
+        e = WriteBytes(file, data, size);
+
+        if (e == noErr && !decompress)
+        {
+            QFSCompressionStats stats;
+            stats.rawLength = 0;
+
+            e = QFSCompressFsh(input.GetAllocator(), file, level, &stats);
+
+            if (e == noErr && printStats && stats.rawLength > 0)
+            {
+                PrintQFSCompressionStats("qfs file", stats);
+            }
+        }
+
+        CloseFile(file);
+    }
+
+    if (e != noErr)
+    {
+        return ReportError(outputPath, e);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        PrintUsage();
+        return EXIT_FAILURE;
+    }
+
+    const char* command = argv[1];
+
+    if (strcmp(command, "info") == 0)
+    {
+        return RunInfo(argc - 2, argv + 2);
+    }
+    else if (strcmp(command, "decode") == 0)
+    {
+        return RunDecode(argc - 2, argv + 2);
+    }
+    else if (strcmp(command, "encode") == 0)
+    {
+        return RunEncode(argc - 2, argv + 2);
+    }
+    else if (strcmp(command, "recompress") == 0)
+    {
+        return RunRecompress(argc - 2, argv + 2);
+    }
+
+    PrintUsage();
+
+    return EXIT_FAILURE;
+}